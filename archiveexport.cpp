@@ -0,0 +1,53 @@
+#include "archiveexport.h"
+#include "censorrender.h"
+#include "tarwriter.h"
+#include <QFile>
+#include <QFileInfo>
+
+namespace ArchiveExport {
+
+bool exportImages(const QStringList &imageAbsPaths, const QVector<ExportRendition> &renditions,
+                  const QString &archivePath, const std::function<bool(int)> &progress,
+                  QStringList &skipped, QString &error)
+{
+    QFile archive(archivePath);
+    if (!archive.open(QFile::WriteOnly | QFile::Truncate)) {
+        error = archive.errorString();
+        return false;
+    }
+    TarWriter tar(&archive);
+
+    auto fail = [&](const QString &message) {
+        error = message;
+        archive.remove();
+        return false;
+    };
+
+    for (int i = 0; i < imageAbsPaths.size(); i++) {
+        const auto &source = imageAbsPaths[i];
+        QFileInfo fi(source);
+
+        QVector<QByteArray> encoded;
+        if (!CensorRender::renderFile(source, renditions, encoded)) {
+            skipped << source;
+        } else {
+            for (int r = 0; r < renditions.size(); r++) {
+                auto name = ExportRenditions::outputName(fi.fileName(), renditions[r]);
+                if (!tar.addFile(name, encoded[r], fi.lastModified().toUTC())) {
+                    return fail(tar.errorString());
+                }
+            }
+        }
+
+        if (progress && !progress(i + 1)) {
+            return fail(QString("Export canceled"));
+        }
+    }
+
+    if (!tar.finish() || !archive.flush()) {
+        return fail(tar.errorString().isEmpty() ? archive.errorString() : tar.errorString());
+    }
+    return true;
+}
+
+} // namespace ArchiveExport
@@ -0,0 +1,25 @@
+#ifndef ARCHIVEEXPORT_H
+#define ARCHIVEEXPORT_H
+
+#include "exportrenditions.h"
+#include <QString>
+#include <QStringList>
+#include <QVector>
+#include <functional>
+
+// Export into a single tar file instead of one file per image. Each image is decoded,
+// censored from its saved sidecar, encoded in memory and appended to the archive, so
+// the export is one long sequential write with no temporary files.
+namespace ArchiveExport {
+
+// Renditions go in as "<file name>", "web/<file name>", ... like a folder export.
+// progress(done) is called after every image and cancels the export by returning false.
+// Images that can't be read or encoded are listed in skipped and left out. Returns
+// false with error set when the archive itself can't be written; it is removed then.
+bool exportImages(const QStringList &imageAbsPaths, const QVector<ExportRendition> &renditions,
+                  const QString &archivePath, const std::function<bool(int)> &progress,
+                  QStringList &skipped, QString &error);
+
+} // namespace ArchiveExport
+
+#endif // ARCHIVEEXPORT_H
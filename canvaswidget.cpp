@@ -1,10 +1,14 @@
 #include "canvaswidget.h"
+#include "maskshapes.h"
 #include <QEvent>
 #include <QDebug>
 #include <QResizeEvent>
-#include <vector>
-#include <array>
 #include <chrono>
+#include <cstring>
+#include <utility>
+
+// Widget pixels from the first vertex within which a click closes a polygon
+static constexpr int ClosePolygonDistance = 8;
 
 CanvasWidget::CanvasWidget(QWidget *parent)
     : QWidget{parent}
@@ -15,13 +19,102 @@ CanvasWidget::CanvasWidget(QWidget *parent)
     m_mouseActionType = None;
     m_previewShowMaskOnly = true;
     m_censorType = CensorType::CT_Pixelize;
+    m_fillColor = Qt::white;
+    m_featherRadius = 0;
+    m_pendingFeatherRadius = 0;
+    m_tool = BrushTool;
+    m_snapShapes = false;
+    m_shapesEdited = false;
+    m_bufferAllocations = 0;
+    m_maskTilesX = 0;
+
+    m_recomputeSerial = 0;
+    m_recomputePending = false;
+    m_refineTimer.setSingleShot(true);
+    m_refineTimer.setInterval(150);
+    connect(&m_refineTimer, &QTimer::timeout, this, [this]() { startBackgroundRecompute(false); });
+    m_featherTimer.setSingleShot(true);
+    m_featherTimer.setInterval(150);
+    connect(&m_featherTimer, &QTimer::timeout, this, &CanvasWidget::applyFeatherRadius);
+}
+
+CanvasWidget::~CanvasWidget()
+{
+    // Jobs post their result back to this object
+    cancelBackgroundRecompute();
+    m_recomputeTasks.wait();
+}
+
+void CanvasWidget::setCensorType(CensorType type)
+{
+    m_censorType = type;
+
+    recomputeCensoredImage();
 }
 
 void CanvasWidget::setChunkSize(int chunkSize)
 {
     m_chunkSize = chunkSize;
+    if (MaskShapes::anySnapped(m_shapes)) {
+        // Snapped shapes follow the grid, mixed down below once the censored image is in
+        updateCensorMask();
+    }
 
-    recomputeCensoredImage();
+    if (m_censorType != CT_Pixelize || m_baseImage.isNull()) {
+        recomputeCensoredImage();
+        return;
+    }
+
+    // Slider ticks arrive faster than a full pixelize on large images. Show a cheap
+    // approximation now and refine once the value settles; each new tick cancels
+    // whatever is still running.
+    startBackgroundRecompute(true);
+    m_refineTimer.start();
+    m_recomputePending = true;
+}
+
+void CanvasWidget::flushPendingRecompute()
+{
+    if (m_featherTimer.isActive()) {
+        applyFeatherRadius();
+    }
+    if (m_recomputePending) {
+        recomputeCensoredImage();
+    }
+}
+
+void CanvasWidget::setFillColor(QColor color)
+{
+    m_fillColor = color;
+
+    // Fill is applied during mixdown, nothing to recompute
+    if (m_censorType == CT_White && !m_baseImage.isNull()) {
+        mixdownToPreviewFramebuffer();
+        update();
+    }
+}
+
+void CanvasWidget::setFeatherRadius(int radius)
+{
+    m_pendingFeatherRadius = radius;
+    m_featherTimer.start();
+}
+
+void CanvasWidget::applyFeatherRadius()
+{
+    m_featherTimer.stop();
+    if (m_pendingFeatherRadius == m_featherRadius) {
+        return;
+    }
+    m_featherRadius = m_pendingFeatherRadius;
+    if (m_baseImage.isNull()) {
+        return;
+    }
+
+    updateCensorMask();
+    mixdownToPreviewFramebuffer();
+    update();
+    reportBufferUsage();
 }
 
 void CanvasWidget::setBrushSize(int diameterPx)
@@ -35,42 +128,132 @@ void CanvasWidget::setBrushSize(int diameterPx)
     }
 }
 
+void CanvasWidget::setTool(Tool tool)
+{
+    cancelDraftShape();
+    m_tool = tool;
+    update();
+}
+
 void CanvasWidget::setPreviewMode(int mode)
 {
     m_previewMode = (PreviewMode)mode;
     update();
 }
 
-void CanvasWidget::switchImage(QImage baseImage, QImage maskImage, MetaConfig meta)
+void CanvasWidget::switchImage(QImage &&baseImage, QImage &&maskImage, const MetaConfig &meta)
 {
-    m_baseImage = baseImage;
+    // Formats without a specialized kernel are converted once here, not per recompute
+    m_baseImage = CensorKernels::toNativeFormat(std::move(baseImage));
     m_censorType = meta.method;
     m_chunkSize = meta.chunkSize;
-    if (maskImage.isNull()) {
-        m_maskImage = QImage(baseImage.size(), QImage::Format_ARGB32_Premultiplied);
-        m_maskImage.fill(Qt::transparent);
-    } else {
-        m_maskImage = maskImage;
-    }
-    this->setFixedSize(baseImage.size());
-    m_censoredImage = QImage(baseImage.size(), QImage::Format_ARGB32_Premultiplied);
-    m_previewFramebuffer = QImage(baseImage.size(), QImage::Format_ARGB32_Premultiplied);
+    m_fillColor = meta.fillColor;
+    m_featherRadius = m_pendingFeatherRadius = meta.featherRadius;
+    m_featherTimer.stop();
+    m_shapes = meta.shapes;
+    m_shapesEdited = false;
+    m_draftShape.points.clear();
+    adoptMask(std::move(maskImage));
+    updateCensorMask();
+    this->setFixedSize(m_baseImage.size());
+    ensureFrameBuffer(m_previewFramebuffer, m_baseImage.size());
+
+    recomputeCensoredImage();
+}
+
+void CanvasWidget::restoreChanges(QImage &&maskImage, const MetaConfig &meta)
+{
+    adoptMask(std::move(maskImage));
+    m_chunkSize = meta.chunkSize;
+    m_censorType = meta.method;
+    m_fillColor = meta.fillColor;
+    m_featherRadius = m_pendingFeatherRadius = meta.featherRadius;
+    m_featherTimer.stop();
+    m_shapes = meta.shapes;
+    m_shapesEdited = false;
+    m_draftShape.points.clear();
+    updateCensorMask();
 
     recomputeCensoredImage();
 }
 
-void CanvasWidget::restoreChanges(QImage maskImage, MetaConfig meta)
+void CanvasWidget::adoptMask(QImage &&maskImage)
 {
+    // Kernels walk mask and base scanlines in lockstep, so the mask must match exactly
     if (maskImage.isNull()) {
-        m_maskImage = QImage(m_baseImage.size(), QImage::Format_ARGB32_Premultiplied);
+        ensureFrameBuffer(m_maskImage, m_baseImage.size());
         m_maskImage.fill(Qt::transparent);
+    } else if (maskImage.size() != m_baseImage.size()) {
+        m_maskImage = maskImage.scaled(m_baseImage.size()).convertToFormat(QImage::Format_ARGB32_Premultiplied);
     } else {
-        m_maskImage = maskImage;
+        // In-place when the mask is already ARGB32-ish, which is what saved masks load as
+        m_maskImage = std::move(maskImage).convertToFormat(QImage::Format_ARGB32_Premultiplied);
     }
-    m_chunkSize = meta.chunkSize;
-    m_censorType = meta.method;
 
-    recomputeCensoredImage();
+    // A fresh mask has no edits yet
+    m_maskTilesX = (m_maskImage.width() + MaskTileSize - 1) / MaskTileSize;
+    int tilesY = (m_maskImage.height() + MaskTileSize - 1) / MaskTileSize;
+    m_dirtyMaskTiles.assign(size_t(m_maskTilesX) * tilesY, 0);
+}
+
+void CanvasWidget::markMaskDirty(const QRect &rect)
+{
+    auto clipped = rect & m_maskImage.rect();
+    if (clipped.isEmpty()) return;
+
+    for (int ty = clipped.top() / MaskTileSize; ty <= clipped.bottom() / MaskTileSize; ty++) {
+        for (int tx = clipped.left() / MaskTileSize; tx <= clipped.right() / MaskTileSize; tx++) {
+            m_dirtyMaskTiles[size_t(ty) * m_maskTilesX + tx] = 1;
+        }
+    }
+}
+
+QVector<QPoint> CanvasWidget::takeDirtyMaskTiles()
+{
+    QVector<QPoint> tiles;
+    for (size_t i = 0; i < m_dirtyMaskTiles.size(); i++) {
+        if (!m_dirtyMaskTiles[i]) continue;
+        tiles.append(QPoint(int(i % m_maskTilesX), int(i / m_maskTilesX)));
+        m_dirtyMaskTiles[i] = 0;
+    }
+    return tiles;
+}
+
+bool CanvasWidget::takeShapesEdited()
+{
+    return std::exchange(m_shapesEdited, false);
+}
+
+void CanvasWidget::remarkDirtyMaskTiles(const QVector<QPoint> &tiles)
+{
+    for (const auto &tile : tiles) {
+        if (tile.x() < 0 || tile.x() >= m_maskTilesX || tile.y() < 0) continue;
+        const size_t i = size_t(tile.y()) * m_maskTilesX + tile.x();
+        if (i < m_dirtyMaskTiles.size()) m_dirtyMaskTiles[i] = 1;
+    }
+}
+
+void CanvasWidget::ensureFrameBuffer(QImage &buffer, QSize size)
+{
+    // A buffer someone else still references would detach on the first write anyway
+    if (buffer.size() == size && buffer.format() == QImage::Format_ARGB32_Premultiplied && buffer.isDetached()) {
+        return;
+    }
+    buffer = QImage(size, QImage::Format_ARGB32_Premultiplied);
+    m_bufferAllocations++;
+}
+
+qint64 CanvasWidget::bufferBytes() const
+{
+    return m_baseImage.sizeInBytes() + m_maskImage.sizeInBytes() + m_shapedMask.sizeInBytes() +
+           m_featheredMask.sizeInBytes() + m_censoredImage.sizeInBytes() +
+           m_censoredBackBuffer.sizeInBytes() + m_previewFramebuffer.sizeInBytes() +
+           m_pixelizeScratch.capacityBytes();
+}
+
+void CanvasWidget::reportBufferUsage()
+{
+    emit bufferUsageChanged(bufferBytes(), m_bufferAllocations);
 }
 
 bool CanvasWidget::eventFilter(QObject *obj, QEvent *event)
@@ -91,31 +274,46 @@ bool CanvasWidget::eventFilter(QObject *obj, QEvent *event)
 
 void CanvasWidget::paintEvent(QPaintEvent *pe)
 {
-    if (m_baseImage.isNull() || m_censoredImage.isNull()) {
+    if (m_baseImage.isNull()) {
         return;
     }
 
+    // Mostly a few brush-sized rects, so only their part of the image is scaled
+    const QRect target = pe->rect();
+    auto drawScaled = [&](QPainter &p, const QImage &image) {
+        double sx = (double)image.width() / width();
+        double sy = (double)image.height() / height();
+        p.drawImage(target, image, QRectF(target.x() * sx, target.y() * sy, target.width() * sx, target.height() * sy));
+    };
+
+    // Strokes and shapes, unfeathered
+    const QImage &mask = m_shapes.isEmpty() ? m_maskImage : m_shapedMask;
+
     QPainter p(this);
 //    p.drawImage(rect(), m_censoredImage.isNull() ? m_baseImage : m_censoredImage);
-    p.drawImage(rect(), m_maskImage);
+    drawScaled(p, mask);
     switch (m_previewMode) {
 
     case PM_Original:
-        p.drawImage(rect(), m_baseImage);
+        drawScaled(p, m_baseImage);
         break;
     case PM_FullyCensored:
-        p.drawImage(rect(), m_censoredImage);
+        if (m_censorType == CT_White) {
+            p.fillRect(target, m_fillColor);
+        } else {
+            drawScaled(p, m_censoredImage);
+        }
         break;
     default:
     case PM_MaskOnly:
-        p.drawImage(rect(), m_maskImage);
+        drawScaled(p, mask);
         break;
     case PM_MaskOnImage:
-        p.drawImage(rect(), m_baseImage);
-        p.drawImage(rect(), m_maskImage);
+        drawScaled(p, m_baseImage);
+        drawScaled(p, mask);
         break;
     case PM_FinalPreview: {
-        p.drawImage(rect(), m_previewFramebuffer);
+        drawScaled(p, m_previewFramebuffer);
         break;
     }
     }
@@ -126,13 +324,42 @@ void CanvasWidget::paintEvent(QPaintEvent *pe)
     p.setBrush(Qt::NoBrush);
     p.drawText(20, 50, QString("Time taken: %1s").arg(m_censorComputationTime));
 
+    if (!m_draftShape.points.isEmpty()) {
+        const double ratio = (double)width() / m_maskImage.width();
+        if (m_draftShape.type == MaskShape::Rect) {
+            p.drawRect(QRectF(m_draftShape.points[0] * ratio, m_draftShape.points[1] * ratio).normalized());
+        } else {
+            QPolygonF outline;
+            for (const auto &point : m_draftShape.points) {
+                outline << point * ratio;
+            }
+            p.drawPolyline(outline);
+        }
+    }
+
     // Brush
-    int brushRadius = std::round(((double)width() / m_baseImage.width()) * m_brushSize);
-    brushRadius /= 2;
-    p.drawEllipse(m_mouseHoverPos, brushRadius, brushRadius);
+    if (m_tool == BrushTool) {
+        int brushRadius = brushCursorRadius();
+        p.drawEllipse(m_mouseHoverPos, brushRadius, brushRadius);
+    }
     p.end();
 }
 
+int CanvasWidget::brushCursorRadius() const
+{
+    if (m_baseImage.isNull()) {
+        return 0;
+    }
+    return int(std::round(((double)width() / m_baseImage.width()) * m_brushSize)) / 2;
+}
+
+QRect CanvasWidget::brushCursorRect() const
+{
+    // Outline is drawn with a 1px pen centered on the radius
+    int extent = brushCursorRadius() + 2;
+    return QRect(m_mouseHoverPos - QPoint(extent, extent), QSize(extent * 2 + 1, extent * 2 + 1));
+}
+
 void CanvasWidget::wheelEvent(QWheelEvent *)
 {
 
@@ -140,19 +367,34 @@ void CanvasWidget::wheelEvent(QWheelEvent *)
 
 void CanvasWidget::mouseMoveEvent(QMouseEvent *e)
 {
+    QRect previousCursor = brushCursorRect();
     m_mouseLastHoverPos = m_mouseHoverPos;
     m_mouseHoverPos = e->pos();
+    if (!m_draftShape.points.isEmpty()) {
+        // The last point follows the cursor: the opposite corner or the next vertex
+        QRect previousDraft = draftShapeRect();
+        m_draftShape.points.last() = mapToImage(e->pos());
+        update(previousDraft.united(draftShapeRect()));
+    }
     processMouseDrag();
-    update();
+    // Hovering only moves the outline, the time label is repainted where it overlaps
+    update(previousCursor.united(brushCursorRect()));
 }
 
 void CanvasWidget::mousePressEvent(QMouseEvent *e)
 {
+    if (e->buttons() == Qt::LeftButton && m_tool != BrushTool) {
+        pressShapeTool(e);
+        return;
+    }
+    if (e->buttons() == Qt::RightButton && !m_draftShape.points.isEmpty()) {
+        cancelDraftShape();
+        return;
+    }
+
     if (e->buttons() == Qt::LeftButton) {
         // Prepare draw censor painter here
         m_drawCensorPainter.begin(&m_maskImage);
-        m_previewFramebuffer.fill(Qt::transparent);
-        m_mixPainter.begin(&m_previewFramebuffer);
         QPen pen = m_drawCensorPainter.pen();
         pen.setColor(Qt::white);
         pen.setWidth(m_brushSize);
@@ -182,7 +424,12 @@ void CanvasWidget::mouseReleaseEvent(QMouseEvent *e)
             m_mouseActionType = None;
             m_mouseLastHoverPos = {-1, -1};
             m_drawCensorPainter.end();
-            m_mixPainter.end();
+        }
+        break;
+    case DrawShape:
+        if (e->button() == Qt::LeftButton) {
+            m_mouseActionType = None;
+            commitDraftShape();
         }
         break;
     case DragCanvas:
@@ -194,6 +441,122 @@ void CanvasWidget::mouseReleaseEvent(QMouseEvent *e)
     }
 }
 
+void CanvasWidget::mouseDoubleClickEvent(QMouseEvent *e)
+{
+    // The first click of the pair already placed the last vertex
+    if (m_tool == PolygonTool && e->button() == Qt::LeftButton && !m_draftShape.points.isEmpty()) {
+        m_draftShape.points.removeLast();
+        commitDraftShape();
+        return;
+    }
+    mousePressEvent(e);
+}
+
+QPointF CanvasWidget::mapToImage(QPoint pos) const
+{
+    return QPointF(pos) * ((double)m_maskImage.width() / width());
+}
+
+void CanvasWidget::pressShapeTool(QMouseEvent *e)
+{
+    if (m_baseImage.isNull()) {
+        return;
+    }
+    const QPointF pos = mapToImage(e->pos());
+
+    if (e->modifiers() & Qt::CTRL) {
+        // Erases like the brush does, a whole shape at a time
+        cancelDraftShape();
+        int index = MaskShapes::shapeAt(m_shapes, QPoint(int(pos.x()), int(pos.y())), m_maskImage.size(), m_chunkSize);
+        if (index >= 0) {
+            QRect bounds = MaskShapes::bounds(m_shapes[index], m_maskImage.size(), m_chunkSize);
+            m_shapes.remove(index);
+            shapesEdited(bounds);
+        }
+        return;
+    }
+
+    if (m_tool == RectangleTool) {
+        startDraftShape(MaskShape::Rect, pos);
+        m_mouseActionType = DrawShape;
+        return;
+    }
+
+    if (m_draftShape.points.isEmpty()) {
+        startDraftShape(MaskShape::Polygon, pos);
+        return;
+    }
+    // Points end with the one following the cursor
+    const double ratio = (double)width() / m_maskImage.width();
+    QPoint first = (m_draftShape.points.first() * ratio).toPoint();
+    if (m_draftShape.points.size() > 3 && (e->pos() - first).manhattanLength() <= ClosePolygonDistance) {
+        m_draftShape.points.removeLast();
+        commitDraftShape();
+        return;
+    }
+    m_draftShape.points.last() = pos;
+    m_draftShape.points.append(pos);
+}
+
+void CanvasWidget::startDraftShape(MaskShape::Type type, QPointF pos)
+{
+    m_draftShape.type = type;
+    m_draftShape.points = { pos, pos };
+    m_draftShape.snapToChunks = m_snapShapes;
+    update(draftShapeRect());
+}
+
+void CanvasWidget::commitDraftShape()
+{
+    QRect previousDraft = draftShapeRect();
+    MaskShape shape = m_draftShape;
+    m_draftShape.points.clear();
+    update(previousDraft);
+
+    // A click without a drag, or a polygon that covers no pixel center
+    if (MaskShapes::rasterize({ shape }, m_maskImage.size(), m_chunkSize).empty()) {
+        return;
+    }
+    m_shapes.append(shape);
+    shapesEdited(MaskShapes::bounds(shape, m_maskImage.size(), m_chunkSize));
+}
+
+void CanvasWidget::cancelDraftShape()
+{
+    if (m_mouseActionType == DrawShape) {
+        m_mouseActionType = None;
+    }
+    if (!m_draftShape.points.isEmpty()) {
+        update(draftShapeRect());
+        m_draftShape.points.clear();
+    }
+}
+
+QRect CanvasWidget::draftShapeRect() const
+{
+    if (m_draftShape.points.isEmpty()) {
+        return QRect();
+    }
+    const double ratio = (double)width() / m_maskImage.width();
+    QRectF bounds = QPolygonF(m_draftShape.points).boundingRect();
+    // Outline is drawn with a 1px pen
+    return QRectF(bounds.topLeft() * ratio, bounds.bottomRight() * ratio).toAlignedRect().adjusted(-2, -2, 2, 2);
+}
+
+void CanvasWidget::shapesEdited(const QRect &bounds)
+{
+    // The soft edge reaches that much further out
+    QRect dirty = bounds.adjusted(-m_featherRadius, -m_featherRadius, m_featherRadius, m_featherRadius);
+    updateCensorMask(dirty);
+    mixdownToPreviewFramebuffer(dirty);
+
+    double ratio = (double)m_maskImage.width() / width();
+    update(QRectF(QPointF(dirty.topLeft()) / ratio, QSizeF(dirty.size()) / ratio).toAlignedRect().adjusted(-1, -1, 1, 1));
+    reportBufferUsage();
+    m_shapesEdited = true;
+    emit censorMaskEdited();
+}
+
 void CanvasWidget::enterEvent(QEvent *)
 {
     m_brushShown = true;
@@ -223,12 +586,26 @@ void CanvasWidget::processMouseDrag()
         mappedBegin = m_mouseLastHoverPos * ratio;
         mappedEnd = m_mouseHoverPos * ratio;
         m_drawCensorPainter.drawLine(mappedBegin, mappedEnd);
-        mixdownToPreviewFramebuffer();
 
-        update();
+        // Only the stroke segment's bounds can have changed
+        int margin = m_brushSize / 2 + 2;
+        QRect dirty = QRect(mappedBegin, mappedEnd).normalized().adjusted(-margin, -margin, margin, margin);
+        markMaskDirty(dirty);
+        if (m_featherRadius > 0) {
+            // The soft edge reaches that much further out
+            dirty.adjust(-m_featherRadius, -m_featherRadius, m_featherRadius, m_featherRadius);
+        }
+        if (m_featherRadius > 0 || !m_shapes.isEmpty()) {
+            updateCensorMask(dirty);
+        }
+        mixdownToPreviewFramebuffer(dirty);
+
+        // Rounded outwards, the scaled image may sample one pixel beyond
+        update(QRectF(QPointF(dirty.topLeft()) / ratio, QSizeF(dirty.size()) / ratio).toAlignedRect().adjusted(-1, -1, 1, 1));
         emit censorMaskEdited();
         break;
     }
+    case DrawShape:
     case DragCanvas:
         break;
     }
@@ -251,6 +628,18 @@ void CanvasWidget::redetermineWidgetSize(QSize containerSize)
 
 void CanvasWidget::recomputeCensoredImage()
 {
+    // Anything computed in the background is stale after this
+    cancelBackgroundRecompute();
+    m_recomputePending = false;
+
+    if (m_baseImage.isNull()) {
+        return;
+    }
+
+    if (m_censorType != CT_White) {
+        ensureFrameBuffer(m_censoredImage, m_baseImage.size());
+    }
+
     switch (m_censorType) {
 
     case CT_Pixelize:
@@ -259,101 +648,137 @@ void CanvasWidget::recomputeCensoredImage()
     case CT_GaussianBlur:
         break;
     case CT_White:
+        // Filled straight from the mask in mixdown, no full-frame censored image at all
+        m_censoredImage = QImage();
+        m_censorComputationTime = 0;
         break;
     }
-
-
-    m_mixPainter.begin(&m_previewFramebuffer);
     mixdownToPreviewFramebuffer();
-    m_mixPainter.end();
+
+    m_imageSize = m_baseImage.size();
+    redetermineWidgetSize(m_parentSize);
+    update();
+    reportBufferUsage();
 }
 
 void CanvasWidget::censorMethodPixelize()
 {
-    int chunkSize = m_chunkSize;
-    QSize imgSmallSize((m_baseImage.width() + chunkSize - 1) / chunkSize,
-                       (m_baseImage.height() + chunkSize - 1) / chunkSize);
-    QImage imgSmall(imgSmallSize, QImage::Format_ARGB32);
-
     auto hrcBegin = std::chrono::high_resolution_clock::now();
 
-    // Construct the mean buckets for a line of resulting pixelized image
-    std::vector<std::array<uint64_t, 3>> meanBucket;
-    meanBucket.resize(imgSmall.width());
-    for (auto &&i : meanBucket) i.fill(0); // Zero all
-
-    std::vector<size_t> chunkWidths(imgSmall.width(), chunkSize);
-    if (m_baseImage.width() % chunkSize) chunkWidths.back() = m_baseImage.width() % chunkSize;
+    CensorKernels::pixelize(m_baseImage, m_chunkSize, m_censoredImage, &m_pixelizeScratch);
 
-    size_t nextRowToDump = 1;
-    for (size_t y = 0; y < m_baseImage.height(); y++) {
-        // One line was previously finished
-        if (nextRowToDump == (y / chunkSize)) {
-            for (size_t i = 0; i < meanBucket.size(); i++) {
-                auto px = imgSmall.bits() + ((nextRowToDump - 1) * imgSmall.width() + i) * 4;
-                size_t meanChunkPixelCount = chunkWidths[i] * chunkSize;
-
-                px[3] = 0xff; // Alpha
-                px[2] = uint8_t(meanBucket[i][0] / meanChunkPixelCount); // Red
-                px[1] = uint8_t(meanBucket[i][1] / meanChunkPixelCount); // Green
-                px[0] = uint8_t(meanBucket[i][2] / meanChunkPixelCount); // Blue
+    auto hrcEnd = std::chrono::high_resolution_clock::now();
+    std::chrono::duration<double> timeTaken = hrcEnd - hrcBegin;
+    m_censorComputationTime = timeTaken.count();
+}
 
-                meanBucket[i].fill(0);
-            }
-            nextRowToDump++;
+void CanvasWidget::startBackgroundRecompute(bool approximate)
+{
+    cancelBackgroundRecompute();
+
+    auto job = std::make_shared<RecomputeJob>();
+    job->serial = m_recomputeSerial;
+    job->approximate = approximate;
+    job->chunkSize = m_chunkSize;
+    job->base = m_baseImage;
+    // The front buffer stays on screen and in mixdown until the job is done
+    job->out = std::move(m_censoredBackBuffer);
+    ensureFrameBuffer(job->out, m_baseImage.size());
+    job->scratch = std::move(m_pixelizeScratch);
+    m_runningJob = job;
+
+    // Submitted without the token: a canceled job still runs to hand its buffers back,
+    // the kernels return at their first poll
+    TaskScheduler::instance().submit(TaskScheduler::Interactive, [this, job]() {
+        auto hrcBegin = std::chrono::high_resolution_clock::now();
+        if (job->approximate) {
+            job->finished = CensorKernels::pixelizeApproximate(job->base, job->chunkSize, job->out, job->cancel.flag());
+        } else {
+            job->finished = CensorKernels::pixelize(job->base, job->chunkSize, job->out, &job->scratch, job->cancel.flag());
         }
+        std::chrono::duration<double> timeTaken = std::chrono::high_resolution_clock::now() - hrcBegin;
+        job->seconds = timeTaken.count();
 
+        QMetaObject::invokeMethod(this, [this, job]() { finishBackgroundRecompute(job); }, Qt::QueuedConnection);
+    }, TaskScheduler::CancelToken(), &m_recomputeTasks);
+}
 
-        for (size_t x = 0; x < m_baseImage.width(); x++) {
-            auto color = m_baseImage.pixel(int(x), int(y));
-            meanBucket[x / chunkSize][0] += qRed(color);
-            meanBucket[x / chunkSize][1] += qGreen(color);
-            meanBucket[x / chunkSize][2] += qBlue(color);
-        }
+void CanvasWidget::cancelBackgroundRecompute()
+{
+    m_refineTimer.stop();
+    if (m_runningJob) {
+        m_runningJob->cancel.cancel();
+        m_runningJob.reset();
     }
+    m_recomputeSerial++;
+}
 
-    // Last line of pixelated
-    for (size_t i = 0; i < meanBucket.size(); i++) {
-        auto px = imgSmall.bits() + ((nextRowToDump - 1) * imgSmall.width() + i) * 4;
-        size_t meanChunkPixelCount = chunkWidths[i] * (m_baseImage.height() % chunkSize ?
-                                                       m_baseImage.height() % chunkSize :
-                                                       chunkSize);
-
-        px[3] = 0xff; // Alpha
-        px[2] = uint8_t(meanBucket[i][0] / meanChunkPixelCount); // Red
-        px[1] = uint8_t(meanBucket[i][1] / meanChunkPixelCount); // Green
-        px[0] = uint8_t(meanBucket[i][2] / meanChunkPixelCount); // Blue
-
-        meanBucket[i].fill(0);
+void CanvasWidget::finishBackgroundRecompute(std::shared_ptr<RecomputeJob> job)
+{
+    // Hand pooled memory back whichever way the job ended
+    if (job->scratch.capacityBytes() > m_pixelizeScratch.capacityBytes()) {
+        m_pixelizeScratch = std::move(job->scratch);
     }
 
-    m_copyPainter.begin(&m_censoredImage);
-    m_copyPainter.setRenderHint(QPainter::Antialiasing, false);
-    m_copyPainter.setRenderHint(QPainter::SmoothPixmapTransform, false);
-    m_copyPainter.drawImage(QRect(QPoint{0, 0},
-                                  QPoint{imgSmall.width() * chunkSize,
-                                         imgSmall.height() * chunkSize}
-                                  ),
-                            imgSmall);
-    m_copyPainter.end();
+    if (job->serial != m_recomputeSerial || !job->finished) {
+        if (m_censoredBackBuffer.isNull()) {
+            m_censoredBackBuffer = std::move(job->out);
+        }
+        return;
+    }
 
-    auto hrcEnd = std::chrono::high_resolution_clock::now();
-    std::chrono::duration<double> timeTaken = hrcEnd - hrcBegin;
-    m_censorComputationTime = timeTaken.count();
-    m_imageSize = m_baseImage.size();
+    std::swap(m_censoredImage, job->out);
+    m_censoredBackBuffer = std::move(job->out);
+    m_censorComputationTime = job->seconds;
+    if (!job->approximate) {
+        m_runningJob.reset();
+        m_recomputePending = false;
+    }
 
-    redetermineWidgetSize(m_parentSize);
+    mixdownToPreviewFramebuffer();
     update();
+    reportBufferUsage();
 }
 
-void CanvasWidget::mixdownToPreviewFramebuffer()
+void CanvasWidget::mixdownToPreviewFramebuffer(const QRect &rect)
 {
-    m_previewFramebuffer.fill(Qt::transparent);
-    m_mixPainter.drawImage(m_previewFramebuffer.rect(), m_maskImage);
-    m_mixPainter.setCompositionMode(QPainter::CompositionMode_SourceIn);
-    m_mixPainter.drawImage(m_previewFramebuffer.rect(), m_censoredImage);
-    m_mixPainter.setCompositionMode(QPainter::CompositionMode_DestinationOver);
-    m_mixPainter.drawImage(m_previewFramebuffer.rect(), m_baseImage);
+    // Single fused pass, specialized on the base image format
+    if (m_censorType == CT_White) {
+        CensorKernels::mixdownSolid(m_baseImage, m_fillColor.rgb(), getCensorMask(), m_previewFramebuffer, rect);
+    } else {
+        CensorKernels::mixdown(m_baseImage, m_censoredImage, getCensorMask(), m_previewFramebuffer, rect);
+    }
 }
 
+void CanvasWidget::updateCensorMask(const QRect &rect)
+{
+    if (m_shapes.isEmpty() || m_maskImage.isNull()) {
+        m_shapedMask = QImage();
+    } else {
+        QRect area = rect & m_maskImage.rect();
+        if (rect.isNull() || m_shapedMask.size() != m_maskImage.size()) {
+            ensureFrameBuffer(m_shapedMask, m_maskImage.size());
+            area = m_maskImage.rect();
+        }
+        // Strokes, then the shapes' spans over them; only rows and chunks in area are touched
+        for (int y = area.top(); y <= area.bottom(); y++) {
+            std::memcpy(reinterpret_cast<QRgb*>(m_shapedMask.scanLine(y)) + area.left(),
+                        reinterpret_cast<const QRgb*>(m_maskImage.constScanLine(y)) + area.left(),
+                        size_t(area.width()) * sizeof(QRgb));
+        }
+        MaskShapes::fill(m_shapedMask, m_shapes, m_chunkSize, area);
+    }
 
+    const QImage &mask = m_shapes.isEmpty() ? m_maskImage : m_shapedMask;
+    if (m_featherRadius <= 0 || mask.isNull()) {
+        m_featheredMask = QImage();
+        return;
+    }
+    if (m_featheredMask.size() != mask.size()) {
+        ensureFrameBuffer(m_featheredMask, mask.size());
+        CensorKernels::featherMask(mask, m_featherRadius, m_featheredMask);
+        return;
+    }
+    // Linear in the area, whatever the radius; a stroke only redoes its own surroundings
+    CensorKernels::featherMask(mask, m_featherRadius, m_featheredMask, rect);
+}
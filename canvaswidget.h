@@ -3,28 +3,79 @@
 
 #include "defs.h"
 #include "mainwindow.h"
+#include "censorkernels.h"
+#include "taskscheduler.h"
 #include <QWidget>
 #include <QPainter>
+#include <QTimer>
+#include <memory>
+#include <vector>
 
 class CanvasWidget : public QWidget
 {
     Q_OBJECT
 public:
     explicit CanvasWidget(QWidget *parent = nullptr);
+    ~CanvasWidget();
 
     void setCensorType(CensorType type);
     CensorType getCensorType() { return m_censorType; }
 
+    // Recomputes in the background: a quick approximation first, full resolution once
+    // the value has stopped changing for a moment
     void setChunkSize(int chunkSize);
+    // Synchronously finishes a background recompute still in flight, e.g. before export
+    void flushPendingRecompute();
+    void setFillColor(QColor color);
+    QColor getFillColor() { return m_fillColor; }
+    // A full-frame feather pass is too slow for every slider tick: it runs once the
+    // radius has stopped changing for a moment, or right away on applyFeatherRadius()
+    void setFeatherRadius(int radius);
+    void applyFeatherRadius();
+    int getFeatherRadius() { return m_pendingFeatherRadius; }
     void setBrushSize(int diameterPx);
 
-    void setPreviewMode(int mode);
+    // Left mouse button: brush strokes, a dragged rectangle or a polygon clicked vertex by
+    // vertex and closed on its first vertex or with a double click. Right click drops an
+    // unfinished shape, Ctrl+click erases strokes or the shape under the cursor.
+    enum Tool {
+        BrushTool,
+        RectangleTool,
+        PolygonTool,
+    };
+    void setTool(Tool tool);
+    // Applies to shapes drawn from now on
+    void setSnapShapesToChunks(bool snap) { m_snapShapes = snap; }
+    const QVector<MaskShape> &getShapes() const { return m_shapes; }
 
-    void switchImage(QImage baseImage, QImage maskImage, MetaConfig meta);
-    void restoreChanges(QImage maskImage, MetaConfig meta);
+    void setPreviewMode(int mode);
 
-    QImage getFinalImage() { return m_previewFramebuffer; }
-    QImage getMaskImage() { return m_maskImage; }
+    // Takes ownership of the images. Buffers of the previous image are reused when
+    // the size matches, so switching between same-sized images allocates nothing.
+    void switchImage(QImage &&baseImage, QImage &&maskImage, const MetaConfig &meta);
+    void restoreChanges(QImage &&maskImage, const MetaConfig &meta);
+
+    // Already composited by the fused mixdown kernel, export encodes it as-is.
+    // Returned by reference so callers don't hold a second ref that forces a detach.
+    const QImage &getFinalImage() const { return m_previewFramebuffer; }
+    const QImage &getMaskImage() const { return m_maskImage; }
+    // What the censored image is blended in with: the mask with the shapes filled in,
+    // feathered when enabled
+    const QImage &getCensorMask() const
+    {
+        return m_featherRadius > 0 ? m_featheredMask : m_shapes.isEmpty() ? m_maskImage : m_shapedMask;
+    }
+
+    // Tiles of the mask edited since the last call, in MaskTileSize units
+    QVector<QPoint> takeDirtyMaskTiles();
+    // Whether shapes were added or removed since the last call
+    bool takeShapesEdited();
+    // Hands back what the two above returned, when it couldn't be journaled
+    void remarkDirtyMaskTiles(const QVector<QPoint> &tiles);
+    void remarkShapesEdited() { m_shapesEdited = true; }
+
+    // Bytes held by the canvas' full-frame buffers and scratch space
+    qint64 bufferBytes() const;
 
 protected:
     virtual bool eventFilter(QObject *obj, QEvent *event) override;
@@ -33,18 +84,50 @@ protected:
     virtual void mouseMoveEvent(QMouseEvent*) override;
     virtual void mousePressEvent(QMouseEvent*) override;
     virtual void mouseReleaseEvent(QMouseEvent*) override;
+    virtual void mouseDoubleClickEvent(QMouseEvent*) override;
     virtual void enterEvent(QEvent*) override;
     virtual void leaveEvent(QEvent*) override;
 
 private:
     void processMouseDrag();
+    int brushCursorRadius() const;
+    QRect brushCursorRect() const; // Widget area the brush outline covers
+
+    QPointF mapToImage(QPoint pos) const;
+    void pressShapeTool(QMouseEvent *e);
+    void startDraftShape(MaskShape::Type type, QPointF pos);
+    void commitDraftShape();
+    void cancelDraftShape();
+    QRect draftShapeRect() const; // Widget area the draft outline covers
+    void shapesEdited(const QRect &bounds);
+
+    void adoptMask(QImage &&maskImage);
+    void markMaskDirty(const QRect &rect);
+    void updateCensorMask(const QRect &rect = QRect());
+    void ensureFrameBuffer(QImage &buffer, QSize size);
+    void reportBufferUsage();
 
     void redetermineWidgetSize(QSize containerSize);
 
     void recomputeCensoredImage();
     void censorMethodPixelize();
 
-    void mixdownToPreviewFramebuffer();
+    struct RecomputeJob {
+        int serial;
+        bool approximate;
+        int chunkSize;
+        QImage base;
+        QImage out;
+        CensorKernels::PixelizeScratch scratch;
+        TaskScheduler::CancelToken cancel;
+        bool finished = false;
+        double seconds = 0;
+    };
+    void startBackgroundRecompute(bool approximate);
+    void cancelBackgroundRecompute();
+    void finishBackgroundRecompute(std::shared_ptr<RecomputeJob> job);
+
+    void mixdownToPreviewFramebuffer(const QRect &rect = QRect());
 
 private:
     QSize m_parentSize;
@@ -52,11 +135,32 @@ private:
     QSize m_imageSize;
     QImage m_baseImage;
     QImage m_maskImage;
+    QImage m_shapedMask; // m_maskImage with m_shapes filled in, only kept while there are shapes
+    QImage m_featheredMask; // Only kept while m_featherRadius > 0
+    QVector<MaskShape> m_shapes;
+    MaskShape m_draftShape; // Being drawn, no points when none is
+    bool m_shapesEdited;
+    Tool m_tool;
+    bool m_snapShapes;
+    int m_featherRadius; // What m_featheredMask is feathered with
+    int m_pendingFeatherRadius;
+    QTimer m_featherTimer;
+    std::vector<uint8_t> m_dirtyMaskTiles;
+    int m_maskTilesX;
     QImage m_censoredImage;
     QImage m_previewFramebuffer;
-    QPainter m_copyPainter, m_drawCensorPainter, m_mixPainter;
+    QImage m_censoredBackBuffer; // Background recompute target, swapped with m_censoredImage
+    CensorKernels::PixelizeScratch m_pixelizeScratch;
+    int m_bufferAllocations;
+    QPainter m_drawCensorPainter;
     double m_censorComputationTime;
 
+    TaskScheduler::TaskGroup m_recomputeTasks;
+    QTimer m_refineTimer;
+    std::shared_ptr<RecomputeJob> m_runningJob;
+    int m_recomputeSerial;
+    bool m_recomputePending;
+
     QPoint m_mouseHoverPos, m_mouseLastHoverPos;
     bool m_brushShown;
     int m_brushSize; // Diameter
@@ -64,17 +168,20 @@ private:
         None,
         DrawCensor,
         EraseCensor,
+        DrawShape,
         DragCanvas,
     } m_mouseActionType;
     PreviewMode m_previewMode;
 
     CensorType m_censorType;
     int m_chunkSize; // for pixelize
+    QColor m_fillColor; // for white
     bool m_previewShowMaskOnly;
     bool m_previewShowFullCensored;
 
 signals:
     void censorMaskEdited();
+    void bufferUsageChanged(qint64 bytes, int allocations);
 };
 
 #endif // CANVASWIDGET_H
@@ -0,0 +1,680 @@
+#include "censorkernels.h"
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define CENSORKERNELS_SSE2
+#endif
+// The baseline stays SSE2; AVX2 code is compiled for that target only and chosen at
+// runtime, so the binary still runs on CPUs without it
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define CENSORKERNELS_AVX2
+#define CENSORKERNELS_AVX2_TARGET
+#elif (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define CENSORKERNELS_AVX2
+#define CENSORKERNELS_AVX2_TARGET __attribute__((target("avx2")))
+#elif defined(_MSC_VER) && defined(_M_X64)
+#include <immintrin.h>
+#include <intrin.h>
+#define CENSORKERNELS_AVX2
+#define CENSORKERNELS_AVX2_TARGET
+#endif
+
+namespace CensorKernels {
+
+namespace {
+
+inline bool isCanceled(const std::atomic_bool *cancel)
+{
+    return cancel && cancel->load(std::memory_order_relaxed);
+}
+
+#ifdef CENSORKERNELS_AVX2
+bool cpuHasAvx2()
+{
+#if defined(__AVX2__)
+    return true;
+#elif defined(__GNUC__) || defined(__clang__)
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+#else
+    int info[4];
+    __cpuid(info, 1);
+    // AVX needs the OS to save YMM state too
+    const bool osAvx = (info[2] & (1 << 27)) && (info[2] & (1 << 28)) && (_xgetbv(0) & 6) == 6;
+    __cpuidex(info, 7, 0);
+    return osAvx && (info[1] & (1 << 5));
+#endif
+}
+
+bool hasAvx2()
+{
+    static const bool supported = cpuHasAvx2();
+    return supported;
+}
+#endif
+
+template<QImage::Format F>
+bool pixelizeImpl(const QImage &base, int chunkSize, QImage &out, PixelizeScratch &scratch,
+                  const std::atomic_bool *cancel)
+{
+    using Traits = PixelTraits<F>;
+    const int width = base.width();
+    const int height = base.height();
+    const int chunksX = (width + chunkSize - 1) / chunkSize;
+
+    // Mean buckets for one line of resulting pixelized image
+    auto &meanBucket = scratch.meanBucket;
+    auto &chunkWidths = scratch.chunkWidths;
+    meanBucket.resize(chunksX);
+    chunkWidths.assign(chunksX, chunkSize);
+    if (width % chunkSize) chunkWidths.back() = width % chunkSize;
+
+    for (int chunkY = 0; chunkY < height; chunkY += chunkSize) {
+        if (isCanceled(cancel)) {
+            return false;
+        }
+        // Last row of chunks may be shorter
+        const int chunkHeight = std::min(chunkSize, height - chunkY);
+
+        for (auto &&i : meanBucket) i.fill(0);
+        for (int y = chunkY; y < chunkY + chunkHeight; y++) {
+            auto line = base.constScanLine(y);
+            for (int i = 0, x = 0; i < chunksX; i++) {
+                auto &bucket = meanBucket[i];
+                for (const int xEnd = x + chunkWidths[i]; x < xEnd; x++) {
+                    uint32_t r, g, b;
+                    Traits::rgb(line, x, r, g, b);
+                    bucket[0] += r;
+                    bucket[1] += g;
+                    bucket[2] += b;
+                }
+            }
+        }
+
+        // Expand the means into the first line of this chunk row, then replicate it
+        auto firstLine = reinterpret_cast<QRgb*>(out.scanLine(chunkY));
+        for (int i = 0, x = 0; i < chunksX; i++) {
+            const uint64_t meanChunkPixelCount = uint64_t(chunkWidths[i]) * chunkHeight;
+            const QRgb mean = qRgb(int(meanBucket[i][0] / meanChunkPixelCount),
+                                   int(meanBucket[i][1] / meanChunkPixelCount),
+                                   int(meanBucket[i][2] / meanChunkPixelCount));
+            std::fill_n(firstLine + x, chunkWidths[i], mean);
+            x += chunkWidths[i];
+        }
+        for (int y = chunkY + 1; y < chunkY + chunkHeight; y++) {
+            std::memcpy(out.scanLine(y), firstLine, size_t(width) * sizeof(QRgb));
+        }
+    }
+    return true;
+}
+
+template<QImage::Format F>
+bool pixelizeApproximateImpl(const QImage &base, int chunkSize, QImage &out, const std::atomic_bool *cancel)
+{
+    using Traits = PixelTraits<F>;
+    const int width = base.width();
+    const int height = base.height();
+
+    for (int chunkY = 0; chunkY < height; chunkY += chunkSize) {
+        if (isCanceled(cancel)) {
+            return false;
+        }
+        const int chunkHeight = std::min(chunkSize, height - chunkY);
+        auto sampleLine = base.constScanLine(chunkY + chunkHeight / 2);
+
+        auto firstLine = reinterpret_cast<QRgb*>(out.scanLine(chunkY));
+        for (int x = 0; x < width; x += chunkSize) {
+            const int chunkWidth = std::min(chunkSize, width - x);
+            uint32_t r, g, b;
+            Traits::rgb(sampleLine, x + chunkWidth / 2, r, g, b);
+            std::fill_n(firstLine + x, chunkWidth, qRgb(int(r), int(g), int(b)));
+        }
+        for (int y = chunkY + 1; y < chunkY + chunkHeight; y++) {
+            std::memcpy(out.scanLine(y), firstLine, size_t(width) * sizeof(QRgb));
+        }
+    }
+    return true;
+}
+
+template<QImage::Format F>
+void pixelizeSpansImpl(const QImage &base, int chunkSize, const std::vector<Span> &spans, QImage &out)
+{
+    using Traits = PixelTraits<F>;
+    const int width = base.width();
+    const int height = base.height();
+    const int chunksX = (width + chunkSize - 1) / chunkSize;
+    std::vector<QRgb> means(chunksX);
+    std::vector<uint8_t> known(chunksX);
+
+    for (size_t first = 0; first < spans.size();) {
+        // Spans in the same row of chunks share its means
+        const int chunkY = spans[first].y / chunkSize * chunkSize;
+        const int chunkHeight = std::min(chunkSize, height - chunkY);
+        size_t last = first;
+        while (last < spans.size() && spans[last].y < chunkY + chunkHeight) last++;
+
+        std::fill(known.begin(), known.end(), 0);
+        for (size_t s = first; s < last; s++) {
+            if (spans[s].x1 <= spans[s].x0) continue;
+            for (int i = spans[s].x0 / chunkSize; i <= (spans[s].x1 - 1) / chunkSize; i++) {
+                if (known[i]) continue;
+                known[i] = 1;
+
+                // Over the whole chunk with the same truncation as pixelize(), so the
+                // pixels match it exactly however much of the chunk the spans cover
+                const int x0 = i * chunkSize;
+                const int x1 = std::min(width, x0 + chunkSize);
+                uint64_t sum[3] = {};
+                for (int y = chunkY; y < chunkY + chunkHeight; y++) {
+                    auto line = base.constScanLine(y);
+                    for (int x = x0; x < x1; x++) {
+                        uint32_t r, g, b;
+                        Traits::rgb(line, x, r, g, b);
+                        sum[0] += r;
+                        sum[1] += g;
+                        sum[2] += b;
+                    }
+                }
+                const uint64_t count = uint64_t(x1 - x0) * chunkHeight;
+                means[i] = qRgb(int(sum[0] / count), int(sum[1] / count), int(sum[2] / count));
+            }
+        }
+
+        for (size_t s = first; s < last; s++) {
+            auto line = reinterpret_cast<QRgb*>(out.scanLine(spans[s].y));
+            for (int x = spans[s].x0; x < spans[s].x1;) {
+                const int i = x / chunkSize;
+                const int xEnd = std::min(spans[s].x1, (i + 1) * chunkSize);
+                std::fill(line + x, line + xEnd, means[i]);
+                x = xEnd;
+            }
+        }
+        first = last;
+    }
+}
+
+// Where the censored pixels come from: a full-frame image, or one solid color
+// for fill-type censoring that never materializes a censored image
+struct ImageSource {
+    const QImage &image;
+    const QRgb *line = nullptr;
+    inline void seekLine(int y) { line = reinterpret_cast<const QRgb*>(image.constScanLine(y)); }
+    inline QRgb at(int x) const { return line[x]; }
+#ifdef CENSORKERNELS_SSE2
+    inline __m128i load4(int x) const { return _mm_loadu_si128(reinterpret_cast<const __m128i*>(line + x)); }
+#endif
+#ifdef CENSORKERNELS_AVX2
+    CENSORKERNELS_AVX2_TARGET inline __m256i load8(int x) const
+    {
+        return _mm256_loadu_si256(reinterpret_cast<const __m256i*>(line + x));
+    }
+#endif
+};
+
+struct SolidSource {
+    QRgb color;
+    inline void seekLine(int) {}
+    inline QRgb at(int) const { return color; }
+#ifdef CENSORKERNELS_SSE2
+    inline __m128i load4(int) const { return _mm_set1_epi32(int(color)); }
+#endif
+#ifdef CENSORKERNELS_AVX2
+    CENSORKERNELS_AVX2_TARGET inline __m256i load8(int) const { return _mm256_set1_epi32(int(color)); }
+#endif
+};
+
+#ifdef CENSORKERNELS_SSE2
+// blendPremultiplied() on four pixels; alpha is the mask alpha already shifted down to
+// the low byte of each 32-bit lane. Bit-exact with the scalar version.
+inline __m128i blend4(__m128i over, __m128i under, __m128i alpha)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i c255 = _mm_set1_epi16(255);
+    const __m128i c128 = _mm_set1_epi16(0x80);
+
+    // Spread each alpha over the four 16-bit channel words of its pixel
+    alpha = _mm_or_si128(alpha, _mm_slli_epi32(alpha, 16));
+    auto half = [&](__m128i o, __m128i u, __m128i a) {
+        __m128i t = _mm_add_epi16(_mm_mullo_epi16(o, a), _mm_mullo_epi16(u, _mm_sub_epi16(c255, a)));
+        t = _mm_add_epi16(t, c128);
+        return _mm_srli_epi16(_mm_add_epi16(t, _mm_srli_epi16(t, 8)), 8);
+    };
+    __m128i lo = half(_mm_unpacklo_epi8(over, zero), _mm_unpacklo_epi8(under, zero), _mm_unpacklo_epi32(alpha, alpha));
+    __m128i hi = half(_mm_unpackhi_epi8(over, zero), _mm_unpackhi_epi8(under, zero), _mm_unpackhi_epi32(alpha, alpha));
+    return _mm_packus_epi16(lo, hi);
+}
+#endif
+
+#ifdef CENSORKERNELS_AVX2
+// Lambdas don't inherit the target attribute, hence a function per step
+CENSORKERNELS_AVX2_TARGET inline __m256i blendHalf8(__m256i over, __m256i under, __m256i alpha)
+{
+    const __m256i c255 = _mm256_set1_epi16(255);
+    const __m256i c128 = _mm256_set1_epi16(0x80);
+    __m256i t = _mm256_add_epi16(_mm256_mullo_epi16(over, alpha), _mm256_mullo_epi16(under, _mm256_sub_epi16(c255, alpha)));
+    t = _mm256_add_epi16(t, c128);
+    return _mm256_srli_epi16(_mm256_add_epi16(t, _mm256_srli_epi16(t, 8)), 8);
+}
+
+// Eight-pixel version of blend4(). Unpacks and packs stay within 128-bit lanes, so the
+// pixel order comes out unchanged.
+CENSORKERNELS_AVX2_TARGET inline __m256i blend8(__m256i over, __m256i under, __m256i alpha)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    alpha = _mm256_or_si256(alpha, _mm256_slli_epi32(alpha, 16));
+    __m256i lo = blendHalf8(_mm256_unpacklo_epi8(over, zero), _mm256_unpacklo_epi8(under, zero), _mm256_unpacklo_epi32(alpha, alpha));
+    __m256i hi = blendHalf8(_mm256_unpackhi_epi8(over, zero), _mm256_unpackhi_epi8(under, zero), _mm256_unpackhi_epi32(alpha, alpha));
+    return _mm256_packus_epi16(lo, hi);
+}
+
+// Eight pixels at a time for mixdownRow32(), returns where it stopped
+template<bool ForceOpaque, typename Source>
+CENSORKERNELS_AVX2_TARGET int mixdownRow32Avx2(const QRgb *baseLine, const Source &source, const QRgb *maskLine,
+                                               QRgb *outLine, int x, const int xEnd)
+{
+    const __m256i opaque = _mm256_set1_epi32(ForceOpaque ? int(0xff000000) : 0);
+    const __m256i full = _mm256_set1_epi32(255);
+    for (; x + 8 <= xEnd; x += 8) {
+        __m256i alpha = _mm256_srli_epi32(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(maskLine + x)), 24);
+        __m256i result;
+        if (_mm256_testz_si256(alpha, alpha)) {
+            result = _mm256_or_si256(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(baseLine + x)), opaque);
+        } else if (_mm256_movemask_epi8(_mm256_cmpeq_epi32(alpha, full)) == -1) {
+            result = source.load8(x);
+        } else {
+            __m256i under = _mm256_or_si256(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(baseLine + x)), opaque);
+            result = blend8(source.load8(x), under, alpha);
+        }
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(outLine + x), result);
+    }
+    return x;
+}
+#endif
+
+// Fast path for bases already stored as premultiplied ARGB32. RGB32 only needs its
+// unused alpha byte forced to 0xff. Reads base, source and mask once, writes out once.
+template<bool ForceOpaque, typename Source>
+void mixdownRow32(const QRgb *baseLine, const Source &source, const QRgb *maskLine, QRgb *outLine, int x, const int xEnd)
+{
+#ifdef CENSORKERNELS_AVX2
+    if (hasAvx2()) {
+        x = mixdownRow32Avx2<ForceOpaque>(baseLine, source, maskLine, outLine, x, xEnd);
+    }
+#endif
+#ifdef CENSORKERNELS_SSE2
+    {
+        const __m128i opaque = _mm_set1_epi32(ForceOpaque ? int(0xff000000) : 0);
+        const __m128i zero = _mm_setzero_si128();
+        const __m128i full = _mm_set1_epi32(255);
+        for (; x + 4 <= xEnd; x += 4) {
+            __m128i alpha = _mm_srli_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(maskLine + x)), 24);
+            __m128i result;
+            if (_mm_movemask_epi8(_mm_cmpeq_epi32(alpha, zero)) == 0xffff) {
+                result = _mm_or_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(baseLine + x)), opaque);
+            } else if (_mm_movemask_epi8(_mm_cmpeq_epi32(alpha, full)) == 0xffff) {
+                result = source.load4(x);
+            } else {
+                __m128i under = _mm_or_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(baseLine + x)), opaque);
+                result = blend4(source.load4(x), under, alpha);
+            }
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(outLine + x), result);
+        }
+    }
+#endif
+    for (; x < xEnd; x++) {
+        const uint32_t alpha = qAlpha(maskLine[x]);
+        const QRgb under = baseLine[x] | (ForceOpaque ? 0xff000000 : 0);
+        if (alpha == 0) {
+            outLine[x] = under;
+        } else if (alpha == 255) {
+            outLine[x] = source.at(x);
+        } else {
+            outLine[x] = blendPremultiplied(source.at(x), under, alpha);
+        }
+    }
+}
+
+// Every other format goes pixel by pixel through its PixelTraits
+template<QImage::Format F, typename Source>
+void mixdownRowGeneric(const uchar *baseLine, const Source &source, const QRgb *maskLine, QRgb *outLine, int x, const int xEnd)
+{
+    using Traits = PixelTraits<F>;
+    for (; x < xEnd; x++) {
+        const uint32_t alpha = qAlpha(maskLine[x]);
+        if (alpha == 0) {
+            outLine[x] = Traits::premultiplied(baseLine, x);
+        } else if (alpha == 255) {
+            outLine[x] = source.at(x);
+        } else {
+            outLine[x] = blendPremultiplied(source.at(x), Traits::premultiplied(baseLine, x), alpha);
+        }
+    }
+}
+
+template<QImage::Format F, typename Source>
+void mixdownImpl(const QImage &base, Source source, const QImage &mask, QImage &out, const QRect &rect)
+{
+    const int xBegin = rect.left();
+    const int xEnd = rect.right() + 1;
+
+    for (int y = rect.top(); y <= rect.bottom(); y++) {
+        auto baseLine = base.constScanLine(y);
+        auto maskLine = reinterpret_cast<const QRgb*>(mask.constScanLine(y));
+        auto outLine = reinterpret_cast<QRgb*>(out.scanLine(y));
+        source.seekLine(y);
+
+        if constexpr (F == QImage::Format_RGB32 || F == QImage::Format_ARGB32_Premultiplied) {
+            mixdownRow32<F == QImage::Format_RGB32>(reinterpret_cast<const QRgb*>(baseLine), source,
+                                                    maskLine, outLine, xBegin, xEnd);
+        } else {
+            mixdownRowGeneric<F>(baseLine, source, maskLine, outLine, xBegin, xEnd);
+        }
+    }
+}
+
+template<typename Source>
+void mixdownDispatch(const QImage &base, Source source, const QImage &mask, QImage &out, QRect rect)
+{
+    Q_ASSERT(mask.format() == QImage::Format_ARGB32_Premultiplied);
+    Q_ASSERT(out.format() == QImage::Format_ARGB32_Premultiplied);
+    rect = rect.isNull() ? out.rect() : rect.intersected(out.rect());
+    if (rect.isEmpty()) {
+        return;
+    }
+    if (!dispatchFormat(base.format(), [&](auto tag) { mixdownImpl<decltype(tag)::value>(base, source, mask, out, rect); })) {
+        mixdownImpl<QImage::Format_ARGB32>(toNativeFormat(base), source, mask, out, rect);
+    }
+}
+
+// Source pixels an output pixel of an area filter covers, and how much of each
+struct AreaTaps {
+    std::vector<int> first;
+    std::vector<int> offset; // Into weights, one past the end for the last output
+    std::vector<float> weights;
+};
+
+AreaTaps areaTaps(int srcSize, int dstSize)
+{
+    AreaTaps taps;
+    const double scale = double(srcSize) / dstSize;
+    for (int i = 0; i < dstSize; i++) {
+        const double begin = i * scale;
+        const double end = std::min(double(srcSize), (i + 1) * scale);
+        const int first = int(begin);
+        const int last = std::min(srcSize - 1, int(std::ceil(end)) - 1);
+        taps.first.push_back(first);
+        taps.offset.push_back(int(taps.weights.size()));
+        for (int s = first; s <= last; s++) {
+            const double cover = std::min(end, s + 1.0) - std::max(begin, double(s));
+            taps.weights.push_back(float(cover / scale));
+        }
+    }
+    taps.offset.push_back(int(taps.weights.size()));
+    return taps;
+}
+
+// Accumulates weight * the four channels of p into acc. The SSE2 and scalar versions do
+// the same float operations in the same order, so both give identical results.
+inline void accumulatePixel(float *acc, QRgb p, float weight)
+{
+#ifdef CENSORKERNELS_SSE2
+    const __m128i zero = _mm_setzero_si128();
+    __m128i wide = _mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(int(p)), zero), zero);
+    __m128 sum = _mm_add_ps(_mm_loadu_ps(acc), _mm_mul_ps(_mm_cvtepi32_ps(wide), _mm_set1_ps(weight)));
+    _mm_storeu_ps(acc, sum);
+#else
+    for (int c = 0; c < 4; c++) acc[c] += float((p >> (8 * c)) & 0xff) * weight;
+#endif
+}
+
+inline void accumulateRow(float *acc, const float *row, float weight)
+{
+#ifdef CENSORKERNELS_SSE2
+    _mm_storeu_ps(acc, _mm_add_ps(_mm_loadu_ps(acc), _mm_mul_ps(_mm_loadu_ps(row), _mm_set1_ps(weight))));
+#else
+    for (int c = 0; c < 4; c++) acc[c] += row[c] * weight;
+#endif
+}
+
+inline QRgb packPixel(const float *acc)
+{
+#ifdef CENSORKERNELS_SSE2
+    // Round to nearest even, like std::lrint in the default rounding mode
+    __m128i v = _mm_cvtps_epi32(_mm_loadu_ps(acc));
+    v = _mm_packs_epi32(v, v);
+    return QRgb(_mm_cvtsi128_si32(_mm_packus_epi16(v, v)));
+#else
+    QRgb p = 0;
+    for (int c = 0; c < 4; c++) p |= QRgb(std::clamp(int(std::lrint(acc[c])), 0, 255)) << (8 * c);
+    return p;
+#endif
+}
+
+// Lower envelope of the parabolas (x - q)^2 + f[q]: d[x] = min over q. v and z are
+// scratch of n and n + 1 entries.
+void distanceTransform1D(const int *f, int n, int *d, int *v, float *z)
+{
+    auto intersection = [f](int p, int q) {
+        return float((f[q] + qint64(q) * q) - (f[p] + qint64(p) * p)) / float(2 * (q - p));
+    };
+
+    int k = 0;
+    v[0] = 0;
+    z[0] = -std::numeric_limits<float>::infinity();
+    z[1] = std::numeric_limits<float>::infinity();
+    for (int q = 1; q < n; q++) {
+        float s = intersection(v[k], q);
+        while (s <= z[k]) {
+            k--;
+            s = intersection(v[k], q);
+        }
+        k++;
+        v[k] = q;
+        z[k] = s;
+        z[k + 1] = std::numeric_limits<float>::infinity();
+    }
+
+    k = 0;
+    for (int q = 0; q < n; q++) {
+        while (z[k + 1] < q) k++;
+        const int p = v[k];
+        d[q] = (q - p) * (q - p) + f[p];
+    }
+}
+
+} // namespace
+
+bool isNativeFormat(QImage::Format format)
+{
+    return dispatchFormat(format, [](auto) {});
+}
+
+QImage toNativeFormat(QImage image)
+{
+    if (image.isNull() || isNativeFormat(image.format())) {
+        return image;
+    }
+    return image.convertToFormat(image.hasAlphaChannel() ? QImage::Format_ARGB32 : QImage::Format_RGB32);
+}
+
+bool pixelize(const QImage &base, int chunkSize, QImage &out, PixelizeScratch *scratch,
+              const std::atomic_bool *cancel)
+{
+    Q_ASSERT(out.format() == QImage::Format_ARGB32_Premultiplied && out.size() == base.size());
+    PixelizeScratch localScratch;
+    auto &s = scratch ? *scratch : localScratch;
+    bool finished = false;
+    if (!dispatchFormat(base.format(), [&](auto tag) {
+            finished = pixelizeImpl<decltype(tag)::value>(base, chunkSize, out, s, cancel);
+        })) {
+        finished = pixelizeImpl<QImage::Format_ARGB32>(toNativeFormat(base), chunkSize, out, s, cancel);
+    }
+    return finished;
+}
+
+bool pixelizeApproximate(const QImage &base, int chunkSize, QImage &out, const std::atomic_bool *cancel)
+{
+    Q_ASSERT(out.format() == QImage::Format_ARGB32_Premultiplied && out.size() == base.size());
+    bool finished = false;
+    if (!dispatchFormat(base.format(), [&](auto tag) {
+            finished = pixelizeApproximateImpl<decltype(tag)::value>(base, chunkSize, out, cancel);
+        })) {
+        finished = pixelizeApproximateImpl<QImage::Format_ARGB32>(toNativeFormat(base), chunkSize, out, cancel);
+    }
+    return finished;
+}
+
+void pixelizeSpans(const QImage &base, int chunkSize, const std::vector<Span> &spans, QImage &out)
+{
+    Q_ASSERT(out.format() == QImage::Format_ARGB32_Premultiplied && out.size() == base.size());
+    if (!dispatchFormat(base.format(), [&](auto tag) {
+            pixelizeSpansImpl<decltype(tag)::value>(base, chunkSize, spans, out);
+        })) {
+        pixelizeSpansImpl<QImage::Format_ARGB32>(toNativeFormat(base), chunkSize, spans, out);
+    }
+}
+
+void fillSpans(QImage &out, QRgb color, const std::vector<Span> &spans)
+{
+    Q_ASSERT(out.format() == QImage::Format_ARGB32_Premultiplied);
+    for (const auto &span : spans) {
+        auto line = reinterpret_cast<QRgb*>(out.scanLine(span.y));
+        std::fill(line + span.x0, line + std::max(span.x0, span.x1), color | 0xff000000);
+    }
+}
+
+void mixdown(const QImage &base, const QImage &censored, const QImage &mask, QImage &out, const QRect &rect)
+{
+    Q_ASSERT(censored.format() == QImage::Format_ARGB32_Premultiplied);
+    mixdownDispatch(base, ImageSource{censored}, mask, out, rect);
+}
+
+void mixdownSolid(const QImage &base, QRgb color, const QImage &mask, QImage &out, const QRect &rect)
+{
+    mixdownDispatch(base, SolidSource{color | 0xff000000}, mask, out, rect);
+}
+
+void downscaleArea(const QImage &src, QImage &out)
+{
+    Q_ASSERT(src.format() == QImage::Format_ARGB32_Premultiplied);
+    Q_ASSERT(out.format() == QImage::Format_ARGB32_Premultiplied);
+    Q_ASSERT(out.width() <= src.width() && out.height() <= src.height());
+    if (src.isNull() || out.isNull()) {
+        return;
+    }
+
+    const auto columns = areaTaps(src.width(), out.width());
+    const auto rows = areaTaps(src.height(), out.height());
+    const int width = out.width();
+
+    // Separable: each source row is filtered horizontally into rowSum, then added
+    // into acc with its vertical weight. Premultiplied averages stay premultiplied.
+    std::vector<float> rowSum(size_t(width) * 4);
+    std::vector<float> acc(size_t(width) * 4);
+    for (int y = 0; y < out.height(); y++) {
+        std::fill(acc.begin(), acc.end(), 0.0f);
+        for (int t = rows.offset[y]; t < rows.offset[y + 1]; t++) {
+            auto srcLine = reinterpret_cast<const QRgb*>(src.constScanLine(rows.first[y] + t - rows.offset[y]));
+            std::fill(rowSum.begin(), rowSum.end(), 0.0f);
+            for (int x = 0; x < width; x++) {
+                auto sum = rowSum.data() + size_t(x) * 4;
+                const int first = columns.first[x];
+                for (int s = columns.offset[x]; s < columns.offset[x + 1]; s++) {
+                    accumulatePixel(sum, srcLine[first + s - columns.offset[x]], columns.weights[s]);
+                }
+            }
+            for (int x = 0; x < width; x++) {
+                accumulateRow(acc.data() + size_t(x) * 4, rowSum.data() + size_t(x) * 4, rows.weights[t]);
+            }
+        }
+
+        auto outLine = reinterpret_cast<QRgb*>(out.scanLine(y));
+        for (int x = 0; x < width; x++) {
+            outLine[x] = packPixel(acc.data() + size_t(x) * 4);
+        }
+    }
+}
+
+void featherMask(const QImage &mask, int radius, QImage &out, const QRect &rect)
+{
+    Q_ASSERT(mask.format() == QImage::Format_ARGB32_Premultiplied);
+    Q_ASSERT(out.format() == QImage::Format_ARGB32_Premultiplied);
+    Q_ASSERT(out.size() == mask.size());
+    radius = std::clamp(radius, 0, MaxFeatherRadius);
+    const QRect target = rect.isNull() ? mask.rect() : rect & mask.rect();
+    if (target.isEmpty()) {
+        return;
+    }
+    // The nearest inside pixel that still matters is at most radius away
+    const QRect window = target.adjusted(-radius, -radius, radius, radius) & mask.rect();
+    const int width = window.width();
+    const int height = window.height();
+    // Anything farther counts as infinitely far, which keeps distances in a byte and
+    // is exact below the cap
+    const int cap = radius + 1;
+    auto inside = [](QRgb p) { return qAlpha(p) >= 128; };
+
+    // Vertical pass: distance to the nearest inside pixel in the same column, both ways
+    std::vector<uint8_t> column(size_t(width) * height);
+    std::vector<uint8_t> running(width, uint8_t(cap));
+    for (int y = 0; y < height; y++) {
+        auto maskLine = reinterpret_cast<const QRgb*>(mask.constScanLine(window.top() + y)) + window.left();
+        auto columnLine = column.data() + size_t(y) * width;
+        for (int x = 0; x < width; x++) {
+            running[x] = inside(maskLine[x]) ? 0 : uint8_t(std::min(cap, running[x] + 1));
+            columnLine[x] = running[x];
+        }
+    }
+    std::fill(running.begin(), running.end(), uint8_t(cap));
+    for (int y = height - 1; y >= 0; y--) {
+        auto maskLine = reinterpret_cast<const QRgb*>(mask.constScanLine(window.top() + y)) + window.left();
+        auto columnLine = column.data() + size_t(y) * width;
+        for (int x = 0; x < width; x++) {
+            running[x] = inside(maskLine[x]) ? 0 : uint8_t(std::min(cap, running[x] + 1));
+            columnLine[x] = std::min(columnLine[x], running[x]);
+        }
+    }
+
+    // Horizontal pass per output row over the column distances squared
+    std::vector<int> f(width), d(width), v(width);
+    std::vector<float> z(size_t(width) + 1);
+    const int capSquared = cap * cap;
+    for (int y = target.top(); y <= target.bottom(); y++) {
+        auto maskLine = reinterpret_cast<const QRgb*>(mask.constScanLine(y));
+        auto outLine = reinterpret_cast<QRgb*>(out.scanLine(y));
+        auto columnLine = column.data() + size_t(y - window.top()) * width;
+
+        if (std::all_of(columnLine, columnLine + width, [cap](uint8_t g) { return g >= cap; })) {
+            // Nothing inside within reach of this row
+            for (int x = target.left(); x <= target.right(); x++) {
+                outLine[x] = qAlpha(maskLine[x]) * 0x01010101u;
+            }
+            continue;
+        }
+
+        for (int x = 0; x < width; x++) {
+            f[x] = columnLine[x] * columnLine[x];
+        }
+        distanceTransform1D(f.data(), width, d.data(), v.data(), z.data());
+        for (int x = target.left(); x <= target.right(); x++) {
+            uint32_t alpha = qAlpha(maskLine[x]);
+            const int distanceSquared = d[x - window.left()];
+            if (distanceSquared < capSquared) {
+                const float ramp = 255.0f * (cap - std::sqrt(float(distanceSquared))) / cap;
+                alpha = std::max(alpha, uint32_t(ramp + 0.5f));
+            }
+            // Only the alpha is ever read, as premultiplied white
+            outLine[x] = alpha * 0x01010101u;
+        }
+    }
+}
+
+} // namespace CensorKernels
@@ -0,0 +1,205 @@
+#ifndef CENSORKERNELS_H
+#define CENSORKERNELS_H
+
+#include <QImage>
+#include <QRgba64>
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <type_traits>
+#include <vector>
+
+namespace CensorKernels {
+
+// Per-format scanline accessors. Kernels are instantiated once per specialization,
+// so the inner loops never go through QImage::pixel() or switch on the format.
+//   rgb()           - unpremultiplied 8-bit channels, same values QImage::pixel() gives
+//   premultiplied() - pixel as stored in Format_ARGB32_Premultiplied
+template<QImage::Format F> struct PixelTraits;
+
+template<> struct PixelTraits<QImage::Format_RGB32> {
+    static inline void rgb(const uchar *line, int x, uint32_t &r, uint32_t &g, uint32_t &b) {
+        auto p = reinterpret_cast<const QRgb*>(line)[x];
+        r = qRed(p); g = qGreen(p); b = qBlue(p);
+    }
+    static inline QRgb premultiplied(const uchar *line, int x) {
+        return reinterpret_cast<const QRgb*>(line)[x] | 0xff000000;
+    }
+};
+
+template<> struct PixelTraits<QImage::Format_ARGB32> {
+    static inline void rgb(const uchar *line, int x, uint32_t &r, uint32_t &g, uint32_t &b) {
+        auto p = reinterpret_cast<const QRgb*>(line)[x];
+        r = qRed(p); g = qGreen(p); b = qBlue(p);
+    }
+    static inline QRgb premultiplied(const uchar *line, int x) {
+        return qPremultiply(reinterpret_cast<const QRgb*>(line)[x]);
+    }
+};
+
+template<> struct PixelTraits<QImage::Format_ARGB32_Premultiplied> {
+    static inline void rgb(const uchar *line, int x, uint32_t &r, uint32_t &g, uint32_t &b) {
+        auto p = qUnpremultiply(reinterpret_cast<const QRgb*>(line)[x]);
+        r = qRed(p); g = qGreen(p); b = qBlue(p);
+    }
+    static inline QRgb premultiplied(const uchar *line, int x) {
+        return reinterpret_cast<const QRgb*>(line)[x];
+    }
+};
+
+template<> struct PixelTraits<QImage::Format_RGB888> {
+    static inline void rgb(const uchar *line, int x, uint32_t &r, uint32_t &g, uint32_t &b) {
+        auto p = line + x * 3;
+        r = p[0]; g = p[1]; b = p[2];
+    }
+    static inline QRgb premultiplied(const uchar *line, int x) {
+        auto p = line + x * 3;
+        return qRgb(p[0], p[1], p[2]);
+    }
+};
+
+template<> struct PixelTraits<QImage::Format_Grayscale8> {
+    static inline void rgb(const uchar *line, int x, uint32_t &r, uint32_t &g, uint32_t &b) {
+        r = g = b = line[x];
+    }
+    static inline QRgb premultiplied(const uchar *line, int x) {
+        return qRgb(line[x], line[x], line[x]);
+    }
+};
+
+template<> struct PixelTraits<QImage::Format_Grayscale16> {
+    // Same rounding as QRgba64::red8() and friends
+    static inline uint32_t to8(uint32_t v) { return (v - (v >> 8) + 0x80) >> 8; }
+    static inline void rgb(const uchar *line, int x, uint32_t &r, uint32_t &g, uint32_t &b) {
+        r = g = b = to8(reinterpret_cast<const quint16*>(line)[x]);
+    }
+    static inline QRgb premultiplied(const uchar *line, int x) {
+        auto v = to8(reinterpret_cast<const quint16*>(line)[x]);
+        return qRgb(v, v, v);
+    }
+};
+
+template<> struct PixelTraits<QImage::Format_RGBX64> {
+    static inline void rgb(const uchar *line, int x, uint32_t &r, uint32_t &g, uint32_t &b) {
+        auto p = reinterpret_cast<const QRgba64*>(line)[x];
+        r = p.red8(); g = p.green8(); b = p.blue8();
+    }
+    static inline QRgb premultiplied(const uchar *line, int x) {
+        return reinterpret_cast<const QRgba64*>(line)[x].toArgb32() | 0xff000000;
+    }
+};
+
+template<> struct PixelTraits<QImage::Format_RGBA64> {
+    static inline void rgb(const uchar *line, int x, uint32_t &r, uint32_t &g, uint32_t &b) {
+        auto p = reinterpret_cast<const QRgba64*>(line)[x];
+        r = p.red8(); g = p.green8(); b = p.blue8();
+    }
+    static inline QRgb premultiplied(const uchar *line, int x) {
+        return qPremultiply(reinterpret_cast<const QRgba64*>(line)[x].toArgb32());
+    }
+};
+
+template<QImage::Format F>
+using FormatTag = std::integral_constant<QImage::Format, F>;
+
+// Calls fn(FormatTag<F>()) for formats that have a PixelTraits specialization.
+// Returns false for everything else, which should go through toNativeFormat() first.
+template<typename Fn>
+inline bool dispatchFormat(QImage::Format format, Fn &&fn)
+{
+    switch (format) {
+    case QImage::Format_RGB32:                  fn(FormatTag<QImage::Format_RGB32>()); return true;
+    case QImage::Format_ARGB32:                 fn(FormatTag<QImage::Format_ARGB32>()); return true;
+    case QImage::Format_ARGB32_Premultiplied:   fn(FormatTag<QImage::Format_ARGB32_Premultiplied>()); return true;
+    case QImage::Format_RGB888:                 fn(FormatTag<QImage::Format_RGB888>()); return true;
+    case QImage::Format_Grayscale8:             fn(FormatTag<QImage::Format_Grayscale8>()); return true;
+    case QImage::Format_Grayscale16:            fn(FormatTag<QImage::Format_Grayscale16>()); return true;
+    case QImage::Format_RGBX64:                 fn(FormatTag<QImage::Format_RGBX64>()); return true;
+    case QImage::Format_RGBA64:                 fn(FormatTag<QImage::Format_RGBA64>()); return true;
+    default:                                    return false;
+    }
+}
+
+bool isNativeFormat(QImage::Format format);
+
+// Formats without a fast path (indexed, 16-bit packed, premultiplied 64-bit, ...)
+// are converted here exactly once when the image is loaded.
+QImage toNativeFormat(QImage image);
+
+// Per-call working memory of pixelize(). Callers that keep one around across calls
+// only pay for it again when an image needs more chunks than any before it.
+struct PixelizeScratch {
+    std::vector<std::array<uint64_t, 3>> meanBucket;
+    std::vector<int> chunkWidths;
+
+    qint64 capacityBytes() const {
+        return qint64(meanBucket.capacity() * sizeof(meanBucket[0]) + chunkWidths.capacity() * sizeof(int));
+    }
+};
+
+// Pixelate base into out, which must be Format_ARGB32_Premultiplied and the same size.
+// Chunk means are over the unpremultiplied RGB; the result is opaque.
+// Polls cancel once per row of chunks and returns false if it was set; out is
+// partially written then.
+bool pixelize(const QImage &base, int chunkSize, QImage &out, PixelizeScratch *scratch = nullptr,
+              const std::atomic_bool *cancel = nullptr);
+
+// Quick preview of pixelize(): each chunk takes the color of its center pixel instead
+// of the mean, so only one pixel per chunk is read
+bool pixelizeApproximate(const QImage &base, int chunkSize, QImage &out,
+                         const std::atomic_bool *cancel = nullptr);
+
+// Pixels [x0, x1) of row y
+struct Span {
+    int y;
+    int x0;
+    int x1;
+};
+
+// pixelize() along spans only, written straight into out with no mask to read. Only the
+// chunks the spans touch are averaged, each over all of its pixels, so the result
+// matches pixelize() exactly. spans are sorted by row; out is Format_ARGB32_Premultiplied
+// and the same size as base.
+void pixelizeSpans(const QImage &base, int chunkSize, const std::vector<Span> &spans, QImage &out);
+// Same for a solid color, made opaque
+void fillSpans(QImage &out, QRgb color, const std::vector<Span> &spans);
+
+// out = censored where the mask alpha is full, base where it is empty, linearly blended
+// in between. censored, mask and out are Format_ARGB32_Premultiplied.
+// One pass over the inputs, SIMD for RGB32/ARGB32_Premultiplied bases. Only pixels
+// inside rect are written; a null rect means the whole image.
+void mixdown(const QImage &base, const QImage &censored, const QImage &mask, QImage &out,
+             const QRect &rect = QRect());
+
+// Same as mixdown() with a solid opaque color in place of the censored image
+void mixdownSolid(const QImage &base, QRgb color, const QImage &mask, QImage &out,
+                  const QRect &rect = QRect());
+
+// Area-averaging downscale: every source pixel contributes in proportion to how much
+// of it an output pixel covers. src and out are Format_ARGB32_Premultiplied, out
+// no larger than src in either dimension. SSE2 per pixel where available.
+void downscaleArea(const QImage &src, QImage &out);
+
+// Soft edge for a mask: pixels within radius of it fade out linearly with their
+// Euclidean distance to the nearest pixel that is at least half covered, keeping
+// their own alpha where that is higher. Distances are exact and come from a separable
+// linear-time transform (Felzenszwalb & Huttenlocher), so a full pass costs the same
+// for any radius. Only pixels inside rect are written, and only mask pixels within
+// radius of rect are read; a null rect means the whole image.
+// mask and out are Format_ARGB32_Premultiplied and the same size.
+constexpr int MaxFeatherRadius = 254;
+void featherMask(const QImage &mask, int radius, QImage &out, const QRect &rect = QRect());
+
+// Premultiplied lerp of all four channels, rounded to nearest
+inline QRgb blendPremultiplied(QRgb over, QRgb under, uint32_t alpha)
+{
+    auto channel = [=](int shift) {
+        uint32_t t = ((over >> shift) & 0xff) * alpha + ((under >> shift) & 0xff) * (255 - alpha) + 0x80;
+        return ((t + (t >> 8)) >> 8) << shift;
+    };
+    return channel(24) | channel(16) | channel(8) | channel(0);
+}
+
+} // namespace CensorKernels
+
+#endif // CENSORKERNELS_H
@@ -0,0 +1,273 @@
+#include "censorrender.h"
+#include "censorkernels.h"
+#include "maskshapes.h"
+#ifdef CENSORME_HAVE_LIBJPEG
+#include "jpegexport.h"
+#endif
+#ifdef CENSORME_HAVE_ZLIB
+#include "pngencoder.h"
+#endif
+#include <QBuffer>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QPainter>
+#include <QSaveFile>
+#include <algorithm>
+
+namespace CensorRender {
+
+QStringList imageFiles(const QString &folder)
+{
+    QDir dir(folder);
+    QStringList files;
+    for (const auto &name : dir.entryList({ "*.jpg", "*.jpeg", "*.png" }, QDir::Files | QDir::NoDotAndDotDot, QDir::Name)) {
+        files << dir.absoluteFilePath(name);
+    }
+    return files;
+}
+
+QString sidecarBasePath(const QString &imageAbsPath)
+{
+    QFileInfo fi(imageAbsPath);
+    return fi.dir().absolutePath() +
+           QDir::separator() +
+           CensorMeDataDir +
+           QDir::separator() +
+           fi.fileName();
+}
+
+bool loadSidecar(const QString &imageAbsPath, QImage &maskOut, MetaConfig &metaOut)
+{
+    QString sidecar = sidecarBasePath(imageAbsPath);
+    maskOut = QImage(sidecar + ".png");
+
+    do {
+        QFile f(sidecar + ".json");
+        if (!f.open(QFile::ReadOnly)) break;
+        QJsonParseError pe;
+        auto jsd = QJsonDocument::fromJson(f.readAll(), &pe);
+        if (pe.error != QJsonParseError::NoError) break;
+        if (!jsd.isObject()) break;
+        auto obj = jsd.object();
+        metaOut.method = (CensorType)obj["method"].toInt(0);
+        metaOut.chunkSize = std::clamp(obj["chunkSize"].toInt(15), 2, 200);
+        metaOut.fillColor = QColor(obj["fillColor"].toString("#ffffff"));
+        if (!metaOut.fillColor.isValid()) metaOut.fillColor = Qt::white;
+        metaOut.featherRadius = std::clamp(obj["featherRadius"].toInt(0), 0, 200);
+        metaOut.shapes = MaskShapes::fromJson(obj["shapes"].toArray());
+
+        return true;
+    } while (false);
+
+    return false;
+}
+
+QByteArray sidecarJson(const MetaConfig &meta)
+{
+    QJsonObject ro;
+    ro["method"] = meta.method;
+    ro["chunkSize"] = meta.chunkSize;
+    ro["fillColor"] = meta.fillColor.name();
+    ro["featherRadius"] = meta.featherRadius;
+    if (!meta.shapes.isEmpty()) {
+        ro["shapes"] = MaskShapes::toJson(meta.shapes);
+    }
+    return QJsonDocument(ro).toJson(QJsonDocument::Compact);
+}
+
+QByteArray encodeMask(const QImage &mask)
+{
+#ifdef CENSORME_HAVE_ZLIB
+    // Someone is waiting for the save to finish
+    return PngEncoder::encode(mask, TaskScheduler::Interactive);
+#else
+    QByteArray encoded;
+    QBuffer buffer(&encoded);
+    buffer.open(QIODevice::WriteOnly);
+    if (!mask.save(&buffer, "PNG")) {
+        return QByteArray();
+    }
+    return encoded;
+#endif
+}
+
+bool saveMask(const QImage &mask, const QString &path)
+{
+    const auto encoded = encodeMask(mask);
+    QSaveFile f(path);
+    return !encoded.isEmpty() &&
+           f.open(QFile::WriteOnly) &&
+           f.write(encoded) == encoded.size() &&
+           f.commit();
+}
+
+QImage adoptMask(QImage mask, QSize size)
+{
+    // Kernels walk mask and base scanlines in lockstep, so the mask must match exactly
+    if (mask.isNull()) {
+        mask = QImage(size, QImage::Format_ARGB32_Premultiplied);
+        mask.fill(Qt::transparent);
+        return mask;
+    }
+    if (mask.size() != size) {
+        return mask.scaled(size).convertToFormat(QImage::Format_ARGB32_Premultiplied);
+    }
+    return std::move(mask).convertToFormat(QImage::Format_ARGB32_Premultiplied);
+}
+
+QImage censorMask(const QImage &mask, const MetaConfig &meta)
+{
+    QImage shaped = mask;
+    if (!meta.shapes.isEmpty()) {
+        MaskShapes::fill(shaped, meta.shapes, meta.chunkSize);
+    }
+    if (meta.featherRadius <= 0) {
+        return shaped;
+    }
+    QImage feathered(mask.size(), QImage::Format_ARGB32_Premultiplied);
+    CensorKernels::featherMask(shaped, meta.featherRadius, feathered);
+    return feathered;
+}
+
+namespace {
+
+bool isClear(const QImage &mask)
+{
+    for (int y = 0; y < mask.height(); y++) {
+        auto line = reinterpret_cast<const QRgb*>(mask.constScanLine(y));
+        for (int x = 0; x < mask.width(); x++) {
+            if (qAlpha(line[x]) != 0) return false;
+        }
+    }
+    return true;
+}
+
+} // namespace
+
+QImage composite(const QImage &base, const QImage &mask, const MetaConfig &meta)
+{
+    QImage frame(base.size(), QImage::Format_ARGB32_Premultiplied);
+    composite(base, mask, meta, frame);
+    return frame;
+}
+
+void composite(const QImage &base, const QImage &mask, const MetaConfig &meta, QImage &frame)
+{
+    auto native = CensorKernels::toNativeFormat(base);
+    if (meta.shapes.isEmpty() || meta.featherRadius > 0) {
+        // Feather blends shapes with strokes, that needs them in one mask
+        const auto censor = censorMask(mask, meta);
+        if (meta.method == CT_White) {
+            CensorKernels::mixdownSolid(native, meta.fillColor.rgb(), censor, frame);
+        } else {
+            // Blur has no kernel yet; pixelize rather than export the area uncensored
+            QImage censored(native.size(), QImage::Format_ARGB32_Premultiplied);
+            CensorKernels::pixelize(native, meta.chunkSize, censored);
+            CensorKernels::mixdown(native, censored, censor, frame);
+        }
+        return;
+    }
+
+    // Strokes first, then shapes straight into the frame: hard edges have nothing to blend
+    const auto spans = MaskShapes::rasterize(meta.shapes, native.size(), meta.chunkSize);
+    if (meta.method == CT_White) {
+        CensorKernels::mixdownSolid(native, meta.fillColor.rgb(), mask, frame);
+        CensorKernels::fillSpans(frame, meta.fillColor.rgb(), spans);
+        return;
+    }
+    if (isClear(mask)) {
+        // Only shapes, no need to pixelize the whole image
+        QPainter painter(&frame);
+        painter.setCompositionMode(QPainter::CompositionMode_Source);
+        painter.drawImage(0, 0, native);
+    } else {
+        QImage censored(native.size(), QImage::Format_ARGB32_Premultiplied);
+        CensorKernels::pixelize(native, meta.chunkSize, censored);
+        CensorKernels::mixdown(native, censored, mask, frame);
+    }
+    CensorKernels::pixelizeSpans(native, meta.chunkSize, spans, frame);
+}
+
+QByteArray encode(const QImage &frame, const QImage &mask, const QString &source,
+                  const QString &outputName, int quality)
+{
+    QByteArray encoded;
+#ifdef CENSORME_HAVE_LIBJPEG
+    // JPEG to JPEG: untouched blocks are copied losslessly, only censored ones are re-encoded.
+    // Downscaled renditions have no blocks in common with the source.
+    if (JpegExport::isJpegFileName(source) && JpegExport::isJpegFileName(outputName) &&
+        frame.size() == mask.size()) {
+        QFile in(source);
+        if (in.open(QFile::ReadOnly) && JpegExport::transcodeCensoredBlocks(in.readAll(), frame, mask, encoded)) {
+            return encoded;
+        }
+    }
+#else
+    Q_UNUSED(mask)
+    Q_UNUSED(source)
+#endif
+#ifdef CENSORME_HAVE_ZLIB
+    // Lossless, quality only sets zlib's effort in Qt's writer and is ignored here
+    if (PngEncoder::isPngFileName(outputName)) {
+        encoded = PngEncoder::encode(frame, TaskScheduler::Export);
+        return encoded;
+    }
+#endif
+
+    QBuffer buffer(&encoded);
+    buffer.open(QIODevice::WriteOnly);
+    auto format = QFileInfo(outputName).suffix().toLatin1();
+    if (!frame.save(&buffer, format.constData(), quality)) {
+        return QByteArray();
+    }
+    return encoded;
+}
+
+bool renderFile(const QString &source, const QVector<ExportRendition> &renditions,
+                QVector<QByteArray> &encodedOut)
+{
+    QImage base(source);
+    if (base.isNull()) {
+        return false;
+    }
+
+    QImage mask;
+    MetaConfig meta = { 15, CT_Pixelize };
+    loadSidecar(source, mask, meta);
+    mask = adoptMask(std::move(mask), base.size());
+    const auto frame = composite(base, mask, meta);
+    // Also what JPEG block copy decides by, so shapes and the feathered margin are re-encoded too
+    mask = censorMask(mask, meta);
+    base = QImage(); // Only the frame is needed from here on
+
+    const auto fileName = QFileInfo(source).fileName();
+    const auto images = ExportRenditions::render(frame, renditions);
+    encodedOut.clear();
+    for (int r = 0; r < renditions.size(); r++) {
+        auto name = ExportRenditions::outputName(fileName, renditions[r]);
+        encodedOut.append(encode(images[r], mask, source, name, renditions[r].quality));
+        if (encodedOut.back().isEmpty()) {
+            return false;
+        }
+    }
+    return true;
+}
+
+QJsonObject exportParameters(const QVector<ExportRendition> &renditions)
+{
+    // Anything that changes the exported bytes for identical inputs belongs in here
+    QJsonObject params;
+    params["renderer"] = 1;
+    params["renditions"] = ExportRenditions::toJson(renditions);
+#ifdef CENSORME_HAVE_LIBJPEG
+    params["jpegBlockCopy"] = true;
+#else
+    params["jpegBlockCopy"] = false;
+#endif
+    return params;
+}
+
+} // namespace CensorRender
@@ -0,0 +1,65 @@
+#ifndef CENSORRENDER_H
+#define CENSORRENDER_H
+
+#include "defs.h"
+#include "exportrenditions.h"
+#include <QByteArray>
+#include <QImage>
+#include <QJsonObject>
+#include <QString>
+#include <QStringList>
+
+// What the editor does to turn an image and its sidecar into an exported file,
+// without a canvas. Used by exports that don't go through the UI.
+namespace CensorRender {
+
+// Images the editor lists in a folder, sorted by name, as absolute paths
+QStringList imageFiles(const QString &folder);
+
+// <dir>/CensorMeData/<file name>; the sidecar files append ".png", ".json", ...
+QString sidecarBasePath(const QString &imageAbsPath);
+
+// Reads the saved mask and metadata of an image. maskOut is null without a saved mask.
+// Returns false, leaving metaOut alone, when there is no valid metadata.
+bool loadSidecar(const QString &imageAbsPath, QImage &maskOut, MetaConfig &metaOut);
+// The ".json" sidecar contents loadSidecar() reads meta back from
+QByteArray sidecarJson(const MetaConfig &meta);
+// The ".png" sidecar contents, encoded on all cores when zlib is available. Returns an
+// empty array on failure.
+QByteArray encodeMask(const QImage &mask);
+// Writes encodeMask() to path, replacing it only once it's complete
+bool saveMask(const QImage &mask, const QString &path);
+
+// Brings a loaded mask to what the kernels take: Format_ARGB32_Premultiplied at size,
+// transparent when there is none
+QImage adoptMask(QImage mask, QSize size);
+
+// The mask the censored image is blended in with: mask as returned by adoptMask() with
+// meta's shapes filled in, feathered when meta asks for it
+QImage censorMask(const QImage &mask, const MetaConfig &meta);
+
+// The canvas' final preview of base, mask as returned by adoptMask(). Without feather,
+// meta's shapes are censored span by span and never go through a mask.
+QImage composite(const QImage &base, const QImage &mask, const MetaConfig &meta);
+// Same, written into frame, which is Format_ARGB32_Premultiplied at base's size and
+// may wrap memory it doesn't own
+void composite(const QImage &base, const QImage &mask, const MetaConfig &meta, QImage &frame);
+
+// Encodes an exported frame in the format of outputName's suffix. A JPEG source
+// exported as JPEG at full size keeps its uncensored blocks bit for bit when libjpeg
+// is available; PNG is deflated on all cores when zlib is. Returns an empty array on
+// failure.
+QByteArray encode(const QImage &frame, const QImage &mask, const QString &source,
+                  const QString &outputName, int quality);
+
+// Decodes source, censors it from its sidecar and encodes every rendition, in order.
+// Returns false when the image can't be read or a rendition can't be encoded.
+bool renderFile(const QString &source, const QVector<ExportRendition> &renditions,
+                QVector<QByteArray> &encodedOut);
+
+// Everything besides the inputs that changes exported bytes, for ExportManifest
+QJsonObject exportParameters(const QVector<ExportRendition> &renditions);
+
+} // namespace CensorRender
+
+#endif // CENSORRENDER_H
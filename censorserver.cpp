@@ -0,0 +1,256 @@
+#include "censorserver.h"
+#include "censorkernels.h"
+#include "censorrender.h"
+#include "maskshapes.h"
+#include <QCoreApplication>
+#include <QDebug>
+#include <QElapsedTimer>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QLocalSocket>
+#include <QPainter>
+#include <QPointer>
+#include <QtEndian>
+#include <algorithm>
+
+namespace {
+
+// Requests are small JSON, pixels always go through shared memory
+constexpr quint32 MaxMessageBytes = 1024 * 1024;
+
+struct RenderResult {
+    QString error;
+    std::shared_ptr<QSharedMemory> segment;
+    QSize size;
+    int bytesPerLine = 0;
+    double renderMs = 0;
+};
+
+// Wraps a client's segment without copying; valid while segment stays attached
+QImage attachImage(QSharedMemory &segment, const QJsonObject &request, QString &error)
+{
+    if (!segment.attach(QSharedMemory::ReadOnly)) {
+        error = segment.errorString();
+        return QImage();
+    }
+    const int width = request["width"].toInt();
+    const int height = request["height"].toInt();
+    const int bytesPerLine = request["bytesPerLine"].toInt();
+    const auto format = QImage::Format(request["format"].toInt());
+    if (width <= 0 || height <= 0 || !CensorKernels::isNativeFormat(format)) {
+        error = "Image size or format not supported";
+        return QImage();
+    }
+    const int bits = QImage::toPixelFormat(format).bitsPerPixel();
+    if (bytesPerLine < (qint64(width) * bits + 7) / 8 || qint64(bytesPerLine) * height > segment.size()) {
+        error = "Image does not fit its shared memory segment";
+        return QImage();
+    }
+    return QImage(static_cast<const uchar*>(segment.constData()), width, height, bytesPerLine, format);
+}
+
+RenderResult render(const QJsonObject &request, const QString &resultKey)
+{
+    QElapsedTimer timer;
+    timer.start();
+    RenderResult result;
+
+    QSharedMemory input;
+    QImage base;
+    if (request.contains("imageKey")) {
+        input.setKey(request["imageKey"].toString());
+        base = attachImage(input, request, result.error);
+    } else {
+        base = QImage(request["image"].toString());
+        if (base.isNull()) result.error = "Cannot read image";
+    }
+    if (base.isNull()) {
+        return result;
+    }
+
+    QImage mask;
+    if (request.contains("mask")) {
+        mask = QImage(request["mask"].toString());
+        if (mask.isNull()) {
+            result.error = "Cannot read mask";
+            return result;
+        }
+    }
+    mask = CensorRender::adoptMask(std::move(mask), base.size());
+    const auto rects = request["rects"].toArray();
+    if (!rects.isEmpty()) {
+        QPainter p(&mask);
+        for (const auto &value : rects) {
+            auto r = value.toArray();
+            p.fillRect(QRect(r.at(0).toInt(), r.at(1).toInt(), r.at(2).toInt(), r.at(3).toInt()), Qt::white);
+        }
+    }
+
+    MetaConfig meta = { 15, CT_Pixelize };
+    meta.method = (CensorType)std::clamp(request["method"].toInt(meta.method), int(CT_Pixelize), int(CT_White));
+    meta.chunkSize = std::clamp(request["chunkSize"].toInt(meta.chunkSize), 2, 200);
+    if (request.contains("fillColor")) {
+        meta.fillColor = QColor(request["fillColor"].toString());
+        if (!meta.fillColor.isValid()) meta.fillColor = Qt::white;
+    }
+    meta.featherRadius = std::clamp(request["featherRadius"].toInt(0), 0, 200);
+    meta.shapes = MaskShapes::fromJson(request["shapes"].toArray());
+
+    // Composited straight into the segment the client maps, nothing is copied out
+    const int bytesPerLine = base.width() * 4;
+    auto segment = std::make_shared<QSharedMemory>(resultKey);
+    if (!segment->create(qint64(bytesPerLine) * base.height())) {
+        result.error = segment->errorString();
+        return result;
+    }
+    QImage frame(static_cast<uchar*>(segment->data()), base.width(), base.height(), bytesPerLine,
+                 QImage::Format_ARGB32_Premultiplied);
+    CensorRender::composite(base, mask, meta, frame);
+
+    result.segment = segment;
+    result.size = base.size();
+    result.bytesPerLine = bytesPerLine;
+    result.renderMs = timer.nsecsElapsed() / 1e6;
+    return result;
+}
+
+} // namespace
+
+CensorServer::CensorServer(QObject *parent)
+    : QObject(parent)
+    , m_serial(0)
+{
+    // Other users on the machine get neither the socket nor, through it, the images
+    m_server.setSocketOptions(QLocalServer::UserAccessOption);
+    connect(&m_server, &QLocalServer::newConnection, this, &CensorServer::acceptConnections);
+}
+
+CensorServer::~CensorServer()
+{
+    // Renders post their results back to this object
+    m_cancel.cancel();
+    m_tasks.wait();
+}
+
+bool CensorServer::listen(const QString &name)
+{
+    if (m_server.listen(name)) {
+        return true;
+    }
+    if (m_server.serverError() != QAbstractSocket::AddressInUseError) {
+        return false;
+    }
+
+    // Only take the name over from a server that is gone, e.g. one that crashed
+    QLocalSocket probe;
+    probe.connectToServer(name);
+    if (probe.waitForConnected(100)) {
+        return false;
+    }
+    QLocalServer::removeServer(name);
+    return m_server.listen(name);
+}
+
+void CensorServer::acceptConnections()
+{
+    while (auto socket = m_server.nextPendingConnection()) {
+        m_connections.insert(socket, Connection());
+        connect(socket, &QLocalSocket::readyRead, this, [this, socket]() { readRequests(socket); });
+        connect(socket, &QLocalSocket::disconnected, this, [this, socket]() {
+            // Segments the client never released go with it
+            m_connections.remove(socket);
+            socket->deleteLater();
+        });
+    }
+}
+
+void CensorServer::readRequests(QLocalSocket *socket)
+{
+    auto it = m_connections.find(socket);
+    if (it == m_connections.end()) {
+        return;
+    }
+    QByteArray &pending = it->pending;
+    pending += socket->readAll();
+
+    while (pending.size() >= 4) {
+        const quint32 length = qFromBigEndian<quint32>(pending.constData());
+        if (length > MaxMessageBytes) {
+            qWarning() << "Dropping client that sent a" << length << "byte message";
+            socket->abort();
+            return;
+        }
+        if (quint32(pending.size()) - 4 < length) {
+            break;
+        }
+
+        QJsonParseError pe;
+        auto doc = QJsonDocument::fromJson(pending.mid(4, int(length)), &pe);
+        pending.remove(0, int(length) + 4);
+        if (pe.error != QJsonParseError::NoError || !doc.isObject()) {
+            reply(socket, { { "ok", false }, { "error", "Malformed request" } });
+            continue;
+        }
+        handleRequest(socket, doc.object());
+    }
+}
+
+void CensorServer::handleRequest(QLocalSocket *socket, const QJsonObject &request)
+{
+    if (request.contains("release")) {
+        m_connections[socket].results.remove(request["release"].toString());
+        return;
+    }
+
+    QElapsedTimer received;
+    received.start();
+    const auto key = QString("censorme-%1-%2").arg(QCoreApplication::applicationPid()).arg(m_serial++);
+    QPointer<QLocalSocket> target(socket);
+
+    // A client is blocked on every request
+    TaskScheduler::instance().submit(TaskScheduler::Interactive, [this, target, request, key, received]() {
+        const double queuedMs = received.nsecsElapsed() / 1e6;
+        auto result = render(request, key);
+        if (result.segment) {
+            result.segment->moveToThread(thread()); // Released on the server's thread
+        }
+
+        QMetaObject::invokeMethod(this, [=]() {
+            auto it = m_connections.find(target.data());
+            if (!target || it == m_connections.end()) {
+                return; // Client is gone, so is the segment once result goes
+            }
+
+            const bool ok = result.error.isEmpty();
+            QJsonObject response;
+            response["id"] = request["id"];
+            response["ok"] = ok;
+            if (ok) {
+                it->results.insert(key, result.segment);
+                response["key"] = key;
+                response["nativeKey"] = result.segment->nativeKey();
+                response["width"] = result.size.width();
+                response["height"] = result.size.height();
+                response["bytesPerLine"] = result.bytesPerLine;
+                response["format"] = int(QImage::Format_ARGB32_Premultiplied);
+                response["queuedMs"] = queuedMs;
+                response["renderMs"] = result.renderMs;
+            } else {
+                response["error"] = result.error;
+            }
+            const double latencyMs = received.nsecsElapsed() / 1e6;
+            response["latencyMs"] = latencyMs;
+            reply(target, response);
+            emit served(request["id"].toVariant().toString(), ok, latencyMs);
+        }, Qt::QueuedConnection);
+    }, m_cancel, &m_tasks);
+}
+
+void CensorServer::reply(QLocalSocket *socket, const QJsonObject &response)
+{
+    const auto payload = QJsonDocument(response).toJson(QJsonDocument::Compact);
+    uchar length[4];
+    qToBigEndian<quint32>(quint32(payload.size()), length);
+    socket->write(reinterpret_cast<const char*>(length), 4);
+    socket->write(payload);
+}
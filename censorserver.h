@@ -0,0 +1,65 @@
+#ifndef CENSORSERVER_H
+#define CENSORSERVER_H
+
+#include "taskscheduler.h"
+#include <QHash>
+#include <QJsonObject>
+#include <QLocalServer>
+#include <QObject>
+#include <QSharedMemory>
+#include <memory>
+
+class QLocalSocket;
+
+// Censoring for other processes over a local socket, without sidecars or the GUI.
+//
+// Messages both ways are a 4-byte big-endian length followed by that many bytes of
+// compact JSON. A request names its input and how to censor it:
+//   { "id": any, echoed back
+//     "image": "/abs/path.jpg"                    - or a shared memory buffer:
+//     "imageKey": "...", "width", "height", "bytesPerLine", "format": QImage::Format
+//     "mask": "/abs/path.png"                     - and/or
+//     "rects": [[x, y, w, h], ...]                - in image pixels
+//     "shapes": [...]                             - as in the sidecar JSON
+//     "method": CensorType, "chunkSize", "fillColor": "#rrggbb", "featherRadius" }
+// The reply carries the censored image in a shared memory segment the server rendered
+// straight into, Format_ARGB32_Premultiplied:
+//   { "id", "ok": true, "key", "nativeKey", "width", "height", "bytesPerLine", "format",
+//     "queuedMs", "renderMs", "latencyMs" }
+//   { "id", "ok": false, "error" }
+// The segment lives until the client sends { "release": key } or disconnects, so it
+// must attach before doing either.
+class CensorServer : public QObject
+{
+    Q_OBJECT
+public:
+    explicit CensorServer(QObject *parent = nullptr);
+    ~CensorServer();
+
+    bool listen(const QString &name);
+    QString errorString() const { return m_server.errorString(); }
+
+signals:
+    // Receipt of the request to the reply being written
+    void served(const QString &id, bool ok, double latencyMs);
+
+private:
+    struct Connection {
+        QByteArray pending; // Received bytes not making up a whole message yet
+        QHash<QString, std::shared_ptr<QSharedMemory>> results;
+    };
+
+    void acceptConnections();
+    void readRequests(QLocalSocket *socket);
+    void handleRequest(QLocalSocket *socket, const QJsonObject &request);
+    void reply(QLocalSocket *socket, const QJsonObject &response);
+
+private:
+    QLocalServer m_server;
+    TaskScheduler::TaskGroup m_tasks;
+    TaskScheduler::CancelToken m_cancel;
+    QHash<QLocalSocket*, Connection> m_connections;
+    quint64 m_serial;
+};
+
+#endif // CENSORSERVER_H
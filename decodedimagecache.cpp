@@ -0,0 +1,133 @@
+#include "decodedimagecache.h"
+#include "censorkernels.h"
+#include <QCryptographicHash>
+#include <QDateTime>
+#include <QDir>
+#include <QFile>
+#include <QSaveFile>
+#include <memory>
+
+namespace {
+
+constexpr quint32 EntryMagic = 0x43444d43; // "CMDC"
+constexpr quint32 EntryVersion = 1;
+
+struct EntryHeader {
+    quint32 magic;
+    quint32 version;
+    qint32 width;
+    qint32 height;
+    qint32 format;
+    qint32 bytesPerLine;
+    qint64 sourceSize;
+    qint64 sourceMtime;
+    quint8 reserved[24];
+};
+static_assert(sizeof(EntryHeader) == 64, "Pixel data must start 64-byte aligned in the mapping");
+
+void unmapEntry(void *info)
+{
+    // Closing the file drops its mapping
+    delete static_cast<QFile*>(info);
+}
+
+} // namespace
+
+DecodedImageCache::DecodedImageCache(const QString &cacheDir, qint64 maxBytes)
+    : m_dir(cacheDir)
+    , m_maxBytes(maxBytes)
+    , m_enabled(false)
+{
+}
+
+void DecodedImageCache::setEnabled(bool enabled)
+{
+    m_enabled = enabled && QDir().mkpath(m_dir);
+}
+
+QImage DecodedImageCache::load(const QString &absPath)
+{
+    if (!m_enabled) {
+        return QImage(absPath);
+    }
+
+    QFileInfo source(absPath);
+    auto entry = entryPath(absPath);
+    auto mapped = mapEntry(entry, source);
+    if (!mapped.isNull()) {
+        return mapped;
+    }
+
+    // Stored in a format the kernels take directly, so a hit needs no conversion either
+    auto decoded = CensorKernels::toNativeFormat(QImage(absPath));
+    // A folder browsed in one session would otherwise grow the cache without bound.
+    // The new entry is the newest, so it is the last to go.
+    if (!decoded.isNull() && storeEntry(entry, source, decoded)) {
+        prune();
+    }
+    return decoded;
+}
+
+void DecodedImageCache::prune()
+{
+    // Oldest first
+    auto entries = QDir(m_dir).entryInfoList({ "*.raw" }, QDir::Files, QDir::Time | QDir::Reversed);
+    qint64 total = 0;
+    for (const auto &fi : entries) total += fi.size();
+    for (const auto &fi : entries) {
+        if (total <= m_maxBytes) break;
+        if (QFile::remove(fi.absoluteFilePath())) total -= fi.size();
+    }
+}
+
+QString DecodedImageCache::entryPath(const QString &absPath) const
+{
+    auto key = QCryptographicHash::hash(absPath.toUtf8(), QCryptographicHash::Sha1).toHex();
+    return m_dir + QDir::separator() + key + ".raw";
+}
+
+QImage DecodedImageCache::mapEntry(const QString &entryPath, const QFileInfo &source) const
+{
+    std::unique_ptr<QFile> file(new QFile(entryPath));
+    if (!file->open(QFile::ReadOnly)) return QImage();
+
+    EntryHeader header;
+    if (file->read(reinterpret_cast<char*>(&header), sizeof(header)) != qint64(sizeof(header))) return QImage();
+    if (header.magic != EntryMagic || header.version != EntryVersion) return QImage();
+    if (header.sourceSize != source.size() ||
+        header.sourceMtime != source.lastModified().toMSecsSinceEpoch()) return QImage();
+
+    auto format = QImage::Format(header.format);
+    if (header.width <= 0 || header.height <= 0 || !CensorKernels::isNativeFormat(format)) return QImage();
+    if (qint64(header.bytesPerLine) * 8 < qint64(header.width) * QImage::toPixelFormat(format).bitsPerPixel()) return QImage();
+    const qint64 dataSize = qint64(header.bytesPerLine) * header.height;
+    if (file->size() < qint64(sizeof(header)) + dataSize) return QImage();
+
+    // Private mapping: pages are copy-on-write, nothing can ever write back into the cache
+    uchar *mapping = file->map(0, qint64(sizeof(header)) + dataSize, QFileDevice::MapPrivateOption);
+    if (!mapping) return QImage();
+
+    // The QImage owns the file from here on and closes it when its last copy goes away
+    return QImage(mapping + sizeof(header), header.width, header.height, header.bytesPerLine,
+                  format, unmapEntry, file.release());
+}
+
+bool DecodedImageCache::storeEntry(const QString &entryPath, const QFileInfo &source, const QImage &image) const
+{
+    EntryHeader header = {};
+    header.magic = EntryMagic;
+    header.version = EntryVersion;
+    header.width = image.width();
+    header.height = image.height();
+    header.format = image.format();
+    header.bytesPerLine = image.bytesPerLine();
+    header.sourceSize = source.size();
+    header.sourceMtime = source.lastModified().toMSecsSinceEpoch();
+
+    // Readers never see a partially written entry
+    QSaveFile f(entryPath);
+    if (!f.open(QFile::WriteOnly)) return false;
+    f.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    f.write(reinterpret_cast<const char*>(image.constBits()), image.sizeInBytes());
+    return f.commit();
+}
@@ -0,0 +1,39 @@
+#ifndef DECODEDIMAGECACHE_H
+#define DECODEDIMAGECACHE_H
+
+#include <QImage>
+#include <QString>
+#include <QFileInfo>
+
+// On-disk cache of decoded pixels. Entries are a small header followed by raw
+// scanlines, and are mmap'ed straight into a QImage on the next load, so revisiting
+// an image costs a page-in instead of a JPEG/PNG decode.
+// An entry is only used while the source's size and mtime still match.
+class DecodedImageCache
+{
+public:
+    // Entries beyond maxBytes are pruned as new ones are stored
+    DecodedImageCache(const QString &cacheDir, qint64 maxBytes);
+
+    void setEnabled(bool enabled);
+    bool isEnabled() const { return m_enabled; }
+
+    // Decodes absPath, or maps it from the cache. Falls back to a plain decode when
+    // the cache is disabled or unusable.
+    QImage load(const QString &absPath);
+
+    // Deletes least recently written entries until the cache fits in its size limit
+    void prune();
+
+private:
+    QString entryPath(const QString &absPath) const;
+    QImage mapEntry(const QString &entryPath, const QFileInfo &source) const;
+    bool storeEntry(const QString &entryPath, const QFileInfo &source, const QImage &image) const;
+
+private:
+    QString m_dir;
+    qint64 m_maxBytes;
+    bool m_enabled;
+};
+
+#endif // DECODEDIMAGECACHE_H
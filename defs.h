@@ -1,6 +1,10 @@
 #ifndef DEFS_H
 #define DEFS_H
 
+#include <QColor>
+#include <QPointF>
+#include <QVector>
+
 enum CensorType {
     CT_Pixelize,
     CT_GaussianBlur,
@@ -15,6 +19,30 @@ enum PreviewMode {
     PM_FinalPreview,
 };
 
+// Rectangle or polygon censored in addition to the brushed mask, in image pixels.
+// A rect is stored as two opposite corners.
+struct MaskShape {
+    enum Type {
+        Rect,
+        Polygon
+    };
+    Type type = Rect;
+    QVector<QPointF> points;
+    bool snapToChunks = false; // Grown to whole pixelize chunks
+};
+
+// Per-image censoring parameters, saved in the sidecar JSON
+struct MetaConfig {
+    int chunkSize;
+    CensorType method;
+    QColor fillColor = Qt::white; // for CT_White
+    int featherRadius = 0; // Soft mask edge in pixels, 0 for hard edges
+    QVector<MaskShape> shapes;
+};
+
 constexpr const char* CensorMeDataDir = "CensorMeData";
 
+// Granularity at which mask edits are tracked and journaled
+constexpr int MaskTileSize = 64;
+
 #endif // DEFS_H
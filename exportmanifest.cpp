@@ -0,0 +1,88 @@
+#include "exportmanifest.h"
+#include <QCryptographicHash>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QDateTime>
+#include <QJsonDocument>
+#include <QSaveFile>
+
+ExportManifest::ExportManifest(const QString &outputDir)
+    : m_dir(outputDir)
+    , m_dirty(false)
+{
+}
+
+bool ExportManifest::load()
+{
+    QFile f(m_dir + QDir::separator() + FileName);
+    if (!f.open(QFile::ReadOnly)) return false;
+    QJsonParseError pe;
+    auto jsd = QJsonDocument::fromJson(f.readAll(), &pe);
+    if (pe.error != QJsonParseError::NoError || !jsd.isObject()) return false;
+    m_entries = jsd.object()["files"].toObject();
+    return true;
+}
+
+bool ExportManifest::save()
+{
+    if (!m_dirty) return true;
+
+    QJsonObject ro;
+    ro["version"] = 1;
+    ro["files"] = m_entries;
+
+    // Written atomically, a half-written manifest would make every output look stale
+    QSaveFile f(m_dir + QDir::separator() + FileName);
+    if (!f.open(QFile::WriteOnly)) return false;
+    f.write(QJsonDocument(ro).toJson(QJsonDocument::Compact));
+    if (!f.commit()) return false;
+    m_dirty = false;
+    return true;
+}
+
+QString ExportManifest::fingerprint(const QString &sourceAbsPath, const QString &sidecarBasePath,
+                                    const QJsonObject &exportParams)
+{
+    QCryptographicHash hash(QCryptographicHash::Sha1);
+
+    // Source images are large and don't change in place, size and mtime are enough
+    QFileInfo source(sourceAbsPath);
+    hash.addData(QByteArray::number(source.size()));
+    hash.addData(QByteArray::number(source.lastModified().toMSecsSinceEpoch()));
+
+    // Sidecars are what actually changes between runs, hash their contents
+    for (auto suffix : { ".png", ".json" }) {
+        QFile f(sidecarBasePath + suffix);
+        if (f.open(QFile::ReadOnly)) {
+            hash.addData(&f);
+        } else {
+            hash.addData(QByteArray("none"));
+        }
+    }
+
+    hash.addData(QJsonDocument(exportParams).toJson(QJsonDocument::Compact));
+    return hash.result().toHex();
+}
+
+bool ExportManifest::isUpToDate(const QString &outputName, const QString &fingerprint) const
+{
+    auto entry = m_entries[outputName].toObject();
+    if (entry["fingerprint"].toString() != fingerprint) return false;
+
+    QFileInfo output(m_dir + QDir::separator() + outputName);
+    return output.exists() &&
+           output.size() == entry["size"].toVariant().toLongLong() &&
+           output.lastModified().toMSecsSinceEpoch() == entry["mtime"].toVariant().toLongLong();
+}
+
+void ExportManifest::record(const QString &outputName, const QString &fingerprint)
+{
+    QFileInfo output(m_dir + QDir::separator() + outputName);
+    QJsonObject entry;
+    entry["fingerprint"] = fingerprint;
+    entry["size"] = QString::number(output.size());
+    entry["mtime"] = QString::number(output.lastModified().toMSecsSinceEpoch());
+    m_entries[outputName] = entry;
+    m_dirty = true;
+}
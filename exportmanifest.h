@@ -0,0 +1,36 @@
+#ifndef EXPORTMANIFEST_H
+#define EXPORTMANIFEST_H
+
+#include <QString>
+#include <QJsonObject>
+
+// Remembers what every file in an export directory was rendered from, so re-running
+// an export can skip outputs whose inputs haven't changed since.
+// Lives as a hidden JSON file in the output directory itself.
+class ExportManifest
+{
+public:
+    static constexpr const char* FileName = ".censorme-manifest.json";
+
+    explicit ExportManifest(const QString &outputDir);
+
+    bool load();
+    bool save();
+
+    // Hash over everything an exported image depends on: source size and mtime, the
+    // sidecar mask and JSON contents, and the export parameters
+    static QString fingerprint(const QString &sourceAbsPath, const QString &sidecarBasePath,
+                               const QJsonObject &exportParams);
+
+    // True when outputName was last written from inputs with this fingerprint and is
+    // still on disk as it was written
+    bool isUpToDate(const QString &outputName, const QString &fingerprint) const;
+    void record(const QString &outputName, const QString &fingerprint);
+
+private:
+    QString m_dir;
+    QJsonObject m_entries;
+    bool m_dirty;
+};
+
+#endif // EXPORTMANIFEST_H
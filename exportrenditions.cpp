@@ -0,0 +1,107 @@
+#include "exportrenditions.h"
+#include "censorkernels.h"
+#include <QFileInfo>
+#include <QJsonObject>
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+
+namespace ExportRenditions {
+
+namespace {
+
+QSize targetSize(QSize frameSize, int maxEdge)
+{
+    const int longest = std::max(frameSize.width(), frameSize.height());
+    if (maxEdge <= 0 || longest <= maxEdge) {
+        return frameSize;
+    }
+    const double scale = double(maxEdge) / longest;
+    return QSize(std::max(1, int(std::lround(frameSize.width() * scale))),
+                 std::max(1, int(std::lround(frameSize.height() * scale))));
+}
+
+} // namespace
+
+ExportRendition full()
+{
+    return { QString(), 0, QString(), 30 };
+}
+
+ExportRendition web()
+{
+    return { "web", 2048, "jpg", 85 };
+}
+
+ExportRendition thumbnail()
+{
+    return { "thumbnail", 320, "jpg", 80 };
+}
+
+bool byName(const QString &name, ExportRendition &out)
+{
+    for (const auto &rendition : { full(), web(), thumbnail() }) {
+        if ((rendition.name.isEmpty() ? QString("full") : rendition.name) == name) {
+            out = rendition;
+            return true;
+        }
+    }
+    return false;
+}
+
+QString outputName(const QString &fileName, const ExportRendition &rendition)
+{
+    QString name = fileName;
+    if (!rendition.suffix.isEmpty()) {
+        name = QFileInfo(fileName).completeBaseName() + "." + rendition.suffix;
+    }
+    return rendition.name.isEmpty() ? name : rendition.name + "/" + name;
+}
+
+QVector<QImage> render(const QImage &frame, const QVector<ExportRendition> &renditions)
+{
+    QVector<QImage> images(renditions.size());
+
+    // Largest first, so every rendition can start from the one before it
+    QVector<int> order(renditions.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(), [&](int a, int b) {
+        auto sa = targetSize(frame.size(), renditions[a].maxEdge);
+        auto sb = targetSize(frame.size(), renditions[b].maxEdge);
+        return qint64(sa.width()) * sa.height() > qint64(sb.width()) * sb.height();
+    });
+
+    const QImage *source = &frame;
+    for (int i : order) {
+        auto size = targetSize(frame.size(), renditions[i].maxEdge);
+        if (size == source->size()) {
+            images[i] = *source;
+            continue;
+        }
+        // Same aspect ratio and shrinking order mean the previous result is never too small
+        // in one dimension unless rounding made it so, fall back to the frame then
+        if (source->width() < size.width() || source->height() < size.height()) {
+            source = &frame;
+        }
+        images[i] = QImage(size, QImage::Format_ARGB32_Premultiplied);
+        CensorKernels::downscaleArea(*source, images[i]);
+        source = &images[i];
+    }
+    return images;
+}
+
+QJsonArray toJson(const QVector<ExportRendition> &renditions)
+{
+    QJsonArray array;
+    for (const auto &r : renditions) {
+        QJsonObject o;
+        o["name"] = r.name;
+        o["maxEdge"] = r.maxEdge;
+        o["suffix"] = r.suffix;
+        o["quality"] = r.quality;
+        array.append(o);
+    }
+    return array;
+}
+
+} // namespace ExportRenditions
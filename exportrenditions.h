@@ -0,0 +1,41 @@
+#ifndef EXPORTRENDITIONS_H
+#define EXPORTRENDITIONS_H
+
+#include <QImage>
+#include <QJsonArray>
+#include <QString>
+#include <QVector>
+
+// One output size/format of an exported image. All renditions of an image are made
+// from the same composited frame, so nothing is decoded or censored twice.
+struct ExportRendition {
+    QString name;       // Subdirectory of the export directory, empty for the main output
+    int maxEdge;        // Longest edge in px, 0 keeps the original size
+    QString suffix;     // Output format by file suffix, empty keeps the source's
+    int quality;
+};
+
+namespace ExportRenditions {
+
+ExportRendition full();
+ExportRendition web();       // 2048 px JPEG
+ExportRendition thumbnail(); // 320 px JPEG
+
+// "full", "web" or "thumbnail", as given on the command line
+bool byName(const QString &name, ExportRendition &out);
+
+// Path relative to the export directory, e.g. "web/IMG_0001.jpg"
+QString outputName(const QString &fileName, const ExportRendition &rendition);
+
+// Renders every rendition from frame (Format_ARGB32_Premultiplied). Each one is area
+// downscaled from the smallest already rendered image that is still large enough, so
+// a thumbnail reads the web-size image rather than the full frame.
+// Renditions never upscale; frame itself is shared, not copied, where no scaling is needed.
+QVector<QImage> render(const QImage &frame, const QVector<ExportRendition> &renditions);
+
+// For the export manifest's parameters
+QJsonArray toJson(const QVector<ExportRendition> &renditions);
+
+} // namespace ExportRenditions
+
+#endif // EXPORTRENDITIONS_H
@@ -0,0 +1,221 @@
+#include "jpegexport.h"
+#include <QFileInfo>
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <csetjmp>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include <jpeglib.h>
+
+namespace JpegExport {
+
+namespace {
+
+struct ErrorManager {
+    jpeg_error_mgr pub;
+    jmp_buf jump;
+};
+
+void errorExit(j_common_ptr cinfo)
+{
+    // The default handler would exit() the whole application
+    longjmp(reinterpret_cast<ErrorManager*>(cinfo->err)->jump, 1);
+}
+
+void discardMessage(j_common_ptr) {}
+
+// 2-D DCT-II as defined by the JPEG spec, on level-shifted samples. Output is in
+// natural (row-major) order, ready to be divided by the quant table.
+void forwardDct(const float in[64], float out[64])
+{
+    static const auto basis = [] {
+        constexpr double pi = 3.14159265358979323846;
+        std::array<float, 64> t{};
+        for (int u = 0; u < 8; u++) {
+            for (int x = 0; x < 8; x++) {
+                double scale = u == 0 ? std::sqrt(0.125) : 0.5;
+                t[u * 8 + x] = float(scale * std::cos((2 * x + 1) * u * pi / 16));
+            }
+        }
+        return t;
+    }();
+
+    float rows[64];
+    for (int y = 0; y < 8; y++) {
+        for (int u = 0; u < 8; u++) {
+            float sum = 0;
+            for (int x = 0; x < 8; x++) sum += in[y * 8 + x] * basis[u * 8 + x];
+            rows[y * 8 + u] = sum;
+        }
+    }
+    for (int v = 0; v < 8; v++) {
+        for (int u = 0; u < 8; u++) {
+            float sum = 0;
+            for (int y = 0; y < 8; y++) sum += basis[v * 8 + y] * rows[y * 8 + u];
+            out[v * 8 + u] = sum;
+        }
+    }
+}
+
+// JFIF full-range RGB -> YCbCr, one component at a time
+inline float componentValue(int component, QRgb p)
+{
+    const float r = qRed(p), g = qGreen(p), b = qBlue(p);
+    switch (component) {
+    default:
+    case 0: return 0.299f * r + 0.587f * g + 0.114f * b;
+    case 1: return -0.168736f * r - 0.331264f * g + 0.5f * b + 128;
+    case 2: return 0.5f * r - 0.418688f * g - 0.081312f * b + 128;
+    }
+}
+
+} // namespace
+
+bool transcodeCensoredBlocks(const QByteArray &sourceJpeg, const QImage &finalImage,
+                             const QImage &mask, QByteArray &out)
+{
+    if (finalImage.isNull() || mask.size() != finalImage.size()) {
+        return false;
+    }
+
+    // Everything with a destructor lives outside the setjmp region below
+    const QImage rgb = (finalImage.format() == QImage::Format_RGB32 ||
+                        finalImage.format() == QImage::Format_ARGB32_Premultiplied) ?
+                           finalImage : finalImage.convertToFormat(QImage::Format_RGB32);
+    const int width = rgb.width();
+    const int height = rgb.height();
+
+    // Which 8x8 pixel cells the mask touches at all
+    const int cellsX = (width + 7) / 8;
+    const int cellsY = (height + 7) / 8;
+    std::vector<uint8_t> dirtyCells(size_t(cellsX) * cellsY, 0);
+    for (int y = 0; y < height; y++) {
+        auto maskLine = reinterpret_cast<const QRgb*>(mask.constScanLine(y));
+        auto cellRow = dirtyCells.data() + size_t(y / 8) * cellsX;
+        for (int x = 0; x < width; x++) {
+            if (qAlpha(maskLine[x])) {
+                cellRow[x / 8] = 1;
+                x |= 7; // Rest of this cell doesn't matter anymore
+            }
+        }
+    }
+    auto blockIsDirty = [&](int cellX, int cellY, int spanX, int spanY) {
+        for (int cy = cellY; cy < std::min(cellY + spanY, cellsY); cy++) {
+            for (int cx = cellX; cx < std::min(cellX + spanX, cellsX); cx++) {
+                if (dirtyCells[size_t(cy) * cellsX + cx]) return true;
+            }
+        }
+        return false;
+    };
+
+    jpeg_decompress_struct src;
+    jpeg_compress_struct dst;
+    ErrorManager err;
+    struct {
+        unsigned char *data;
+        unsigned long size;
+    } encoded = { nullptr, 0 };
+    std::memset(&src, 0, sizeof(src));
+    std::memset(&dst, 0, sizeof(dst));
+    src.err = jpeg_std_error(&err.pub);
+    dst.err = &err.pub;
+    err.pub.error_exit = errorExit;
+    err.pub.output_message = discardMessage;
+
+    if (setjmp(err.jump)) {
+        jpeg_destroy_compress(&dst);
+        jpeg_destroy_decompress(&src);
+        std::free(encoded.data);
+        return false;
+    }
+
+    jpeg_create_decompress(&src);
+    jpeg_create_compress(&dst);
+    jpeg_mem_src(&src, const_cast<unsigned char*>(reinterpret_cast<const unsigned char*>(sourceJpeg.constData())),
+                 (unsigned long)sourceJpeg.size());
+    jpeg_read_header(&src, TRUE);
+
+    bool supported = int(src.image_width) == width && int(src.image_height) == height &&
+                     src.data_precision == 8 &&
+                     ((src.jpeg_color_space == JCS_YCbCr && src.num_components == 3) ||
+                      (src.jpeg_color_space == JCS_GRAYSCALE && src.num_components == 1));
+    for (int ci = 0; supported && ci < src.num_components; ci++) {
+        supported = src.max_h_samp_factor % src.comp_info[ci].h_samp_factor == 0 &&
+                    src.max_v_samp_factor % src.comp_info[ci].v_samp_factor == 0;
+    }
+    if (!supported) {
+        jpeg_destroy_compress(&dst);
+        jpeg_destroy_decompress(&src);
+        return false;
+    }
+
+    jvirt_barray_ptr *coefficients = jpeg_read_coefficients(&src);
+
+    for (int ci = 0; ci < src.num_components; ci++) {
+        const jpeg_component_info *comp = src.comp_info + ci;
+        const JQUANT_TBL *quant = comp->quant_table;
+        // Pixels covered by one sample of this component, e.g. 2x2 for 4:2:0 chroma
+        const int spanX = src.max_h_samp_factor / comp->h_samp_factor;
+        const int spanY = src.max_v_samp_factor / comp->v_samp_factor;
+        const float sampleArea = float(spanX * spanY);
+
+        for (JDIMENSION by = 0; by < comp->height_in_blocks; by++) {
+            JBLOCKARRAY blockRow = (*src.mem->access_virt_barray)(reinterpret_cast<j_common_ptr>(&src),
+                                                                   coefficients[ci], by, 1, TRUE);
+            for (JDIMENSION bx = 0; bx < comp->width_in_blocks; bx++) {
+                if (!blockIsDirty(int(bx) * spanX, int(by) * spanY, spanX, spanY)) {
+                    continue;
+                }
+
+                float samples[64], dct[64];
+                for (int i = 0; i < 8; i++) {
+                    for (int j = 0; j < 8; j++) {
+                        const int x0 = (int(bx) * 8 + j) * spanX;
+                        const int y0 = (int(by) * 8 + i) * spanY;
+                        float sum = 0;
+                        for (int dy = 0; dy < spanY; dy++) {
+                            // Blocks hanging over the image edge replicate the last row/column,
+                            // as the encoder does
+                            auto line = reinterpret_cast<const QRgb*>(rgb.constScanLine(std::min(y0 + dy, height - 1)));
+                            for (int dx = 0; dx < spanX; dx++) {
+                                sum += componentValue(ci, line[std::min(x0 + dx, width - 1)]);
+                            }
+                        }
+                        samples[i * 8 + j] = sum / sampleArea - 128;
+                    }
+                }
+                forwardDct(samples, dct);
+
+                JCOEF *block = blockRow[0][bx];
+                for (int k = 0; k < 64; k++) {
+                    block[k] = JCOEF(std::lround(dct[k] / quant->quantval[k]));
+                }
+            }
+        }
+    }
+
+    jpeg_copy_critical_parameters(&src, &dst);
+    dst.optimize_coding = TRUE;
+    jpeg_mem_dest(&dst, &encoded.data, &encoded.size);
+    jpeg_write_coefficients(&dst, coefficients);
+    jpeg_finish_compress(&dst);
+    jpeg_finish_decompress(&src);
+
+    out = QByteArray(reinterpret_cast<const char*>(encoded.data), int(encoded.size));
+
+    jpeg_destroy_compress(&dst);
+    jpeg_destroy_decompress(&src);
+    std::free(encoded.data);
+    return true;
+}
+
+bool isJpegFileName(const QString &fileName)
+{
+    auto suffix = QFileInfo(fileName).suffix().toLower();
+    return suffix == "jpg" || suffix == "jpeg";
+}
+
+} // namespace JpegExport
@@ -0,0 +1,25 @@
+#ifndef JPEGEXPORT_H
+#define JPEGEXPORT_H
+
+#include <QImage>
+#include <QString>
+#include <QByteArray>
+
+namespace JpegExport {
+
+// Re-encodes only the DCT blocks of sourceJpeg that the censor mask touches, taking
+// their pixels from finalImage. All other blocks keep the source's quantized
+// coefficients bit-for-bit, so untouched areas lose no quality and skip the
+// decode/encode round trip. Metadata segments are not carried over.
+//
+// Returns false (and writes nothing) when the source can't be transcoded this way,
+// e.g. CMYK, unusual sampling factors or a size that doesn't match finalImage.
+// Callers should fall back to a regular QImage::save() then.
+bool transcodeCensoredBlocks(const QByteArray &sourceJpeg, const QImage &finalImage,
+                             const QImage &mask, QByteArray &out);
+
+bool isJpegFileName(const QString &fileName);
+
+} // namespace JpegExport
+
+#endif // JPEGEXPORT_H
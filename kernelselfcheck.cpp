@@ -0,0 +1,470 @@
+#include "kernelselfcheck.h"
+#include "censorkernels.h"
+#include "maskshapes.h"
+#ifdef CENSORME_HAVE_ZLIB
+#include "pngencoder.h"
+#endif
+#include <QPainter>
+#include <QRect>
+#include <algorithm>
+#include <cstring>
+#include <limits>
+#include <vector>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+
+namespace KernelSelfCheck {
+
+namespace {
+
+// outside, with rect (clipped, all of it when null) taken from inside
+QImage withRect(const QImage &outside, const QImage &inside, QRect rect)
+{
+    QImage out = outside.copy();
+    rect = rect.isNull() ? out.rect() : rect & out.rect();
+    for (int y = rect.top(); y <= rect.bottom(); y++) {
+        std::memcpy(reinterpret_cast<QRgb*>(out.scanLine(y)) + rect.left(),
+                    reinterpret_cast<const QRgb*>(inside.constScanLine(y)) + rect.left(),
+                    size_t(rect.width()) * sizeof(QRgb));
+    }
+    return out;
+}
+
+// outside, with the pixels mask covers fully taken from inside
+QImage withMask(const QImage &outside, const QImage &inside, const QImage &mask)
+{
+    QImage out = outside.copy();
+    for (int y = 0; y < out.height(); y++) {
+        auto line = reinterpret_cast<QRgb*>(out.scanLine(y));
+        auto in = reinterpret_cast<const QRgb*>(inside.constScanLine(y));
+        auto m = reinterpret_cast<const QRgb*>(mask.constScanLine(y));
+        for (int x = 0; x < out.width(); x++) {
+            if (qAlpha(m[x]) == 255) line[x] = in[x];
+        }
+    }
+    return out;
+}
+
+// Written for obviousness, not speed. Source pixels are read through QImage::pixel(),
+// so every format goes through Qt's own conversion rather than PixelTraits. pixelize()
+// and mixdown() are the QPainter pipeline the kernels replaced, so they show the
+// kernels still produce what the canvas used to.
+namespace Reference {
+
+// The original: chunk means, truncated, into a small image that is drawn scaled up
+// without smoothing. It drew into QRect(QPoint(0, 0), QPoint(w * c, h * c)), whose
+// inclusive corner stretched the image by a pixel and moved chunk edges in the right
+// and bottom half; here it is drawn at its exact size, the one intended difference.
+QImage pixelize(const QImage &base, int chunkSize)
+{
+    QImage small((base.width() + chunkSize - 1) / chunkSize, (base.height() + chunkSize - 1) / chunkSize,
+                 QImage::Format_ARGB32);
+    for (int cy = 0; cy < small.height(); cy++) {
+        for (int cx = 0; cx < small.width(); cx++) {
+            // Chunks on the right and bottom edge are smaller and averaged over what they cover
+            const QRect chunk = QRect(cx * chunkSize, cy * chunkSize, chunkSize, chunkSize) & base.rect();
+            uint64_t r = 0, g = 0, b = 0;
+            for (int y = chunk.top(); y <= chunk.bottom(); y++) {
+                for (int x = chunk.left(); x <= chunk.right(); x++) {
+                    auto p = base.pixel(x, y);
+                    r += qRed(p);
+                    g += qGreen(p);
+                    b += qBlue(p);
+                }
+            }
+            const uint64_t n = uint64_t(chunk.width()) * chunk.height();
+            small.setPixel(cx, cy, qRgb(int(r / n), int(g / n), int(b / n)));
+        }
+    }
+
+    QImage out(base.size(), QImage::Format_ARGB32_Premultiplied);
+    out.fill(Qt::transparent);
+    QPainter p(&out);
+    p.setRenderHint(QPainter::Antialiasing, false);
+    p.setRenderHint(QPainter::SmoothPixmapTransform, false);
+    p.drawImage(QRect(0, 0, small.width() * chunkSize, small.height() * chunkSize), small);
+    p.end();
+    return out;
+}
+
+QImage pixelizeApproximate(const QImage &base, int chunkSize)
+{
+    QImage out(base.size(), QImage::Format_ARGB32_Premultiplied);
+    for (int cy = 0; cy < base.height(); cy += chunkSize) {
+        for (int cx = 0; cx < base.width(); cx += chunkSize) {
+            const QRect chunk = QRect(cx, cy, chunkSize, chunkSize) & base.rect();
+            auto p = base.pixel(chunk.left() + chunk.width() / 2, chunk.top() + chunk.height() / 2);
+            const QRgb sample = qRgb(qRed(p), qGreen(p), qBlue(p));
+            for (int y = chunk.top(); y <= chunk.bottom(); y++) {
+                std::fill_n(reinterpret_cast<QRgb*>(out.scanLine(y)) + chunk.left(), chunk.width(), sample);
+            }
+        }
+    }
+    return out;
+}
+
+// The original three passes: the mask, the censored image kept where the mask is
+// (SourceIn), the base under what's left (DestinationOver). A null censored image stands
+// for the solid color, which never had a QPainter version; it goes through the same
+// passes as a filled image. The original always did the whole frame, only rect of it
+// is taken here.
+QImage mixdown(const QImage &base, const QImage &censored, QRgb solid, const QImage &mask,
+               const QImage &outBefore, QRect rect)
+{
+    QImage over = censored;
+    if (over.isNull()) {
+        over = QImage(base.size(), QImage::Format_ARGB32_Premultiplied);
+        over.fill(solid | 0xff000000);
+    }
+
+    QImage composed(base.size(), QImage::Format_ARGB32_Premultiplied);
+    composed.fill(Qt::transparent);
+    QPainter p(&composed);
+    p.drawImage(0, 0, mask);
+    p.setCompositionMode(QPainter::CompositionMode_SourceIn);
+    p.drawImage(0, 0, over);
+    p.setCompositionMode(QPainter::CompositionMode_DestinationOver);
+    p.drawImage(0, 0, base);
+    p.end();
+
+    return withRect(outBefore, composed, rect);
+}
+
+// Distance to the nearest pixel that is at least half covered by trying every one, then
+// the same ramp as the kernel; the distance is exact either way, so this is bit-exact
+QImage featherMask(const QImage &mask, int radius)
+{
+    std::vector<QPoint> insidePixels;
+    for (int y = 0; y < mask.height(); y++) {
+        for (int x = 0; x < mask.width(); x++) {
+            if (qAlpha(mask.pixel(x, y)) >= 128) insidePixels.push_back(QPoint(x, y));
+        }
+    }
+
+    const int cap = std::min(radius, CensorKernels::MaxFeatherRadius) + 1;
+    QImage out(mask.size(), QImage::Format_ARGB32_Premultiplied);
+    for (int y = 0; y < mask.height(); y++) {
+        for (int x = 0; x < mask.width(); x++) {
+            int best = std::numeric_limits<int>::max();
+            for (const auto &p : insidePixels) {
+                best = std::min(best, (p.x() - x) * (p.x() - x) + (p.y() - y) * (p.y() - y));
+            }
+            uint32_t alpha = qAlpha(reinterpret_cast<const QRgb*>(mask.constScanLine(y))[x]);
+            if (best < cap * cap) {
+                const float ramp = 255.0f * (cap - std::sqrt(float(best))) / cap;
+                alpha = std::max(alpha, uint32_t(ramp + 0.5f));
+            }
+            reinterpret_cast<QRgb*>(out.scanLine(y))[x] = alpha * 0x01010101u;
+        }
+    }
+    return out;
+}
+
+// Exact coverage in double precision
+QImage downscaleArea(const QImage &src, QSize size)
+{
+    QImage out(size, QImage::Format_ARGB32_Premultiplied);
+    const double scaleX = double(src.width()) / size.width();
+    const double scaleY = double(src.height()) / size.height();
+    for (int y = 0; y < size.height(); y++) {
+        for (int x = 0; x < size.width(); x++) {
+            double sum[4] = {};
+            for (int sy = int(y * scaleY); sy < std::min(src.height(), int(std::ceil((y + 1) * scaleY))); sy++) {
+                double coverY = std::min((y + 1) * scaleY, sy + 1.0) - std::max(y * scaleY, double(sy));
+                for (int sx = int(x * scaleX); sx < std::min(src.width(), int(std::ceil((x + 1) * scaleX))); sx++) {
+                    double coverX = std::min((x + 1) * scaleX, sx + 1.0) - std::max(x * scaleX, double(sx));
+                    QRgb p = reinterpret_cast<const QRgb*>(src.constScanLine(sy))[sx];
+                    for (int c = 0; c < 4; c++) sum[c] += ((p >> (8 * c)) & 0xff) * coverX * coverY;
+                }
+            }
+            QRgb result = 0;
+            for (int c = 0; c < 4; c++) result |= QRgb(std::lround(sum[c] / (scaleX * scaleY))) << (8 * c);
+            reinterpret_cast<QRgb*>(out.scanLine(y))[x] = result;
+        }
+    }
+    return out;
+}
+
+} // namespace Reference
+
+QImage randomImage(std::mt19937 &rng, QSize size, QImage::Format format)
+{
+    QImage img(size, QImage::Format_ARGB32);
+    for (int y = 0; y < size.height(); y++) {
+        auto line = reinterpret_cast<QRgb*>(img.scanLine(y));
+        for (int x = 0; x < size.width(); x++) line[x] = QRgb(rng());
+    }
+    return format == QImage::Format_ARGB32 ? img : img.convertToFormat(format);
+}
+
+QImage randomMask(std::mt19937 &rng, QSize size)
+{
+    // Runs of empty, full and partial coverage, like brush strokes and their edges.
+    // The SIMD paths take shortcuts on the first two.
+    QImage mask(size, QImage::Format_ARGB32_Premultiplied);
+    for (int y = 0; y < size.height(); y++) {
+        auto line = reinterpret_cast<QRgb*>(mask.scanLine(y));
+        int x = 0;
+        while (x < size.width()) {
+            int run = 1 + int(rng() % 24);
+            int kind = int(rng() % 3);
+            for (; run > 0 && x < size.width(); run--, x++) {
+                int a = kind == 0 ? 0 : kind == 1 ? 255 : int(rng() % 256);
+                line[x] = qRgba(a, a, a, a);
+            }
+        }
+    }
+    return mask;
+}
+
+// A few rectangles and polygons, overlapping at times, some snapped to chunks, some
+// partly or wholly off the image
+QVector<MaskShape> randomShapes(std::mt19937 &rng, QSize size)
+{
+    auto coordinate = [&](int extent) { return int(rng() % (4 * extent + 81)) / 4.0 - 10; };
+    QVector<MaskShape> shapes;
+    for (int count = 1 + int(rng() % 4); count > 0; count--) {
+        MaskShape shape;
+        shape.type = rng() % 2 ? MaskShape::Rect : MaskShape::Polygon;
+        for (int n = shape.type == MaskShape::Rect ? 2 : 3 + int(rng() % 5); n > 0; n--) {
+            shape.points.append(QPointF(coordinate(size.width()), coordinate(size.height())));
+        }
+        shape.snapToChunks = rng() % 2;
+        shapes.append(shape);
+    }
+    return shapes;
+}
+
+// Largest per-channel difference, or -1 on a size mismatch
+int maxChannelError(const QImage &a, const QImage &b)
+{
+    if (a.size() != b.size()) return -1;
+    int worst = 0;
+    for (int y = 0; y < a.height(); y++) {
+        auto la = reinterpret_cast<const QRgb*>(a.constScanLine(y));
+        auto lb = reinterpret_cast<const QRgb*>(b.constScanLine(y));
+        for (int x = 0; x < a.width(); x++) {
+            for (int shift = 0; shift < 32; shift += 8) {
+                worst = std::max(worst, std::abs(int((la[x] >> shift) & 0xff) - int((lb[x] >> shift) & 0xff)));
+            }
+        }
+    }
+    return worst;
+}
+
+#ifdef CENSORME_HAVE_ZLIB
+// As in the IHDR chunk
+enum PngColorType { PngGray = 0, PngRgb = 2, PngGrayAlpha = 4, PngRgba = 6 };
+
+// Runs of a few colours, so deflate finds matches, also across PngEncoder's block cuts.
+// Gray and opaque as colorType needs, in the format such images come in: masks
+// premultiplied, photos without alpha.
+QImage pngSample(std::mt19937 &rng, QSize size, int colorType)
+{
+    const bool gray = colorType == PngGray || colorType == PngGrayAlpha;
+    const bool opaque = colorType == PngGray || colorType == PngRgb;
+    QRgb palette[8];
+    for (auto &p : palette) {
+        const QRgb c = QRgb(rng());
+        p = qRgba(qRed(c), gray ? qRed(c) : qGreen(c), gray ? qRed(c) : qBlue(c), opaque ? 255 : qAlpha(c));
+    }
+    // The first pixel alone must call for colorType, even in a 1x1 image
+    palette[0] = qRgba(qRed(palette[0]), gray ? qRed(palette[0]) : qRed(palette[0]) ^ 0x80, qBlue(palette[0]),
+                       opaque ? 255 : qAlpha(palette[0]) & 0x7f);
+
+    QImage img(size, QImage::Format_ARGB32);
+    QRgb color = palette[0];
+    int run = 1 + int(rng() % 64);
+    for (int y = 0; y < size.height(); y++) {
+        auto line = reinterpret_cast<QRgb*>(img.scanLine(y));
+        for (int x = 0; x < size.width(); x++, run--) {
+            if (run == 0) {
+                color = palette[rng() % 8];
+                run = 1 + int(rng() % 64);
+            }
+            line[x] = color;
+        }
+    }
+    return img.convertToFormat(opaque ? QImage::Format_RGB32 :
+                               gray ? QImage::Format_ARGB32_Premultiplied : QImage::Format_ARGB32);
+}
+
+// Encodes, decodes with Qt's own PNG reader and compares. 1 on a mismatch.
+int checkPngRoundTrip(std::mt19937 &rng, QSize size, int colorType)
+{
+    const int level = int(rng() % 10);
+    const auto image = pngSample(rng, size, colorType);
+    const auto png = PngEncoder::encode(image, TaskScheduler::Interactive, level);
+
+    // Signature, IHDR length and type, width, height, bit depth, then the colour type
+    const int colorTypeOffset = 25;
+    const char *problem = nullptr;
+    int error = 0;
+    QImage decoded;
+    if (png.size() <= colorTypeOffset) {
+        problem = "encode failed";
+    } else if (uchar(png[colorTypeOffset]) != colorType) {
+        problem = "colour type";
+        error = uchar(png[colorTypeOffset]);
+    } else if (!decoded.loadFromData(png, "PNG")) {
+        problem = "decode failed";
+    } else {
+        // Straight alpha on both sides, like the encoder writes it
+        error = maxChannelError(decoded.convertToFormat(QImage::Format_ARGB32), image.convertToFormat(QImage::Format_ARGB32));
+        if (error != 0) problem = "pixels";
+    }
+    if (!problem) return 0;
+    std::fprintf(stderr, "MISMATCH PngEncoder %s: colour type %d, %dx%d, level %d, error %d\n",
+                 problem, colorType, size.width(), size.height(), level, error);
+    return 1;
+}
+#endif
+
+} // namespace
+
+int run(int iterations, quint32 seed)
+{
+    std::fprintf(stderr, "Verifying censor kernels: %d iterations, seed %u\n", iterations, seed);
+    std::mt19937 rng(seed);
+
+    // Shared on purpose, growing and reusing it across sizes is part of what's checked
+    CensorKernels::PixelizeScratch scratch;
+    int mismatches = 0;
+
+    for (int i = 0; i < iterations; i++) {
+        // Round robin, so even short runs cover every format
+        auto format = QImage::Format(1 + i % (QImage::NImageFormats - 1));
+        // Odd sizes on purpose: partial edge chunks and SIMD loop tails
+        QSize size(1 + int(rng() % 97), 1 + int(rng() % 67));
+        int chunkSize = 2 + int(rng() % 40);
+
+        auto base = randomImage(rng, size, format);
+        if (base.isNull()) continue; // Format this Qt can't convert to
+        const int tolerance = CensorKernels::isNativeFormat(format) ? 0 : 1;
+
+        auto check = [&](const char *kernel, const QImage &actual, const QImage &expected, int allowed) {
+            int error = maxChannelError(actual, expected);
+            if (error >= 0 && error <= allowed) return;
+            std::fprintf(stderr, "MISMATCH %s: iteration %d, format %d, %dx%d, chunk %d, error %d\n",
+                         kernel, i, int(format), size.width(), size.height(), chunkSize, error);
+            mismatches++;
+        };
+
+        QImage censored(size, QImage::Format_ARGB32_Premultiplied);
+        CensorKernels::pixelize(base, chunkSize, censored, &scratch);
+        check("pixelize", censored, Reference::pixelize(base, chunkSize), tolerance);
+
+        // Against pixelize() where the shapes' own mask is set, the rest must keep the
+        // sentinel. Odd sizes leave partial chunks at the right and bottom edges.
+        const auto shapes = randomShapes(rng, size);
+        QRect shapeClip;
+        if (rng() % 2) {
+            shapeClip = QRect(int(rng() % size.width()) - 4, int(rng() % size.height()) - 4,
+                              1 + int(rng() % size.width()), 1 + int(rng() % size.height()));
+        }
+        const auto spans = MaskShapes::rasterize(shapes, size, chunkSize, shapeClip);
+        QImage shapeMask(size, QImage::Format_ARGB32_Premultiplied);
+        shapeMask.fill(0);
+        MaskShapes::fill(shapeMask, shapes, chunkSize, shapeClip);
+        QImage sentinel(size, QImage::Format_ARGB32_Premultiplied);
+        sentinel.fill(0x80402010u);
+        QImage spanned = sentinel.copy();
+        CensorKernels::pixelizeSpans(base, chunkSize, spans, spanned);
+        check("pixelizeSpans", spanned, withMask(sentinel, censored, shapeMask), 0);
+
+        const QRgb spanColor = QRgb(rng());
+        QImage solidColor(size, QImage::Format_ARGB32_Premultiplied);
+        solidColor.fill(spanColor | 0xff000000u);
+        spanned = sentinel.copy();
+        CensorKernels::fillSpans(spanned, spanColor, spans);
+        check("fillSpans", spanned, withMask(sentinel, solidColor, shapeMask), 0);
+
+        QImage approximate(size, QImage::Format_ARGB32_Premultiplied);
+        CensorKernels::pixelizeApproximate(base, chunkSize, approximate);
+        check("pixelizeApproximate", approximate, Reference::pixelizeApproximate(base, chunkSize), tolerance);
+
+        // Sub-rects may hang over the edge, the kernels clip them
+        auto mask = randomMask(rng, size);
+        QRect rect;
+        if (rng() % 2) {
+            rect = QRect(int(rng() % size.width()) - 4, int(rng() % size.height()) - 4,
+                         1 + int(rng() % size.width()), 1 + int(rng() % size.height()));
+        }
+        // Pixels outside rect must keep whatever was there
+        QImage out(size, QImage::Format_ARGB32_Premultiplied);
+        out.fill(0x80402010u);
+        // QPainter rounds the SourceIn and DestinationOver terms separately, the kernel
+        // rounds their sum once: off by at most one, plus one more for converted formats
+        auto expected = Reference::mixdown(base, censored, 0, mask, out, rect);
+        CensorKernels::mixdown(base, censored, mask, out, rect);
+        check("mixdown", out, expected, tolerance + 1);
+
+        QRgb solid = QRgb(rng());
+        out.fill(0x80402010u);
+        expected = Reference::mixdown(base, QImage(), solid, mask, out, rect);
+        CensorKernels::mixdownSolid(base, solid, mask, out, rect);
+        check("mixdownSolid", out, expected, tolerance + 1);
+
+        // Float accumulation vs. exact coverage, may round the other way near .5
+        QSize scaled(1 + int(rng() % size.width()), 1 + int(rng() % size.height()));
+        QImage downscaled(scaled, QImage::Format_ARGB32_Premultiplied);
+        CensorKernels::downscaleArea(out, downscaled);
+        check("downscaleArea", downscaled, Reference::downscaleArea(out, scaled), 1);
+
+        // The reference is quadratic in the pixel count, so only a corner of the mask.
+        // Mostly small radii, sometimes ones reaching past the whole image.
+        auto featherSource = mask.copy(QRect(0, 0, std::min(size.width(), 40), std::min(size.height(), 32)));
+        const QSize featherSize = featherSource.size();
+        const int radius = rng() % 4 ? int(rng() % 12) : int(rng() % (CensorKernels::MaxFeatherRadius + 1));
+        auto featherExpected = Reference::featherMask(featherSource, radius);
+        QImage feathered(featherSize, QImage::Format_ARGB32_Premultiplied);
+        CensorKernels::featherMask(featherSource, radius, feathered);
+        check("featherMask", feathered, featherExpected, 0);
+
+        // A sub-rect, at times hanging over the edges, must leave everything else alone
+        auto randomRect = [&]() {
+            return QRect(int(rng() % featherSize.width()) - 3, int(rng() % featherSize.height()) - 3,
+                         1 + int(rng() % featherSize.width()), 1 + int(rng() % featherSize.height()));
+        };
+        const QRect featherRect = randomRect();
+        QImage untouched(featherSize, QImage::Format_ARGB32_Premultiplied);
+        untouched.fill(0x80402010u);
+        QImage partial = untouched.copy();
+        CensorKernels::featherMask(featherSource, radius, partial, featherRect);
+        check("featherMask rect", partial, withRect(untouched, featherExpected, featherRect), 0);
+
+        // An edit, updated as far as it reaches, like the canvas does after a stroke
+        const QRect edit = randomRect();
+        for (int y = std::max(0, edit.top()); y <= std::min(featherSize.height() - 1, edit.bottom()); y++) {
+            auto line = reinterpret_cast<QRgb*>(featherSource.scanLine(y));
+            for (int x = std::max(0, edit.left()); x <= std::min(featherSize.width() - 1, edit.right()); x++) {
+                const int a = rng() % 2 ? 0 : int(rng() % 256);
+                line[x] = qRgba(a, a, a, a);
+            }
+        }
+        CensorKernels::featherMask(featherSource, radius, feathered, edit.adjusted(-radius, -radius, radius, radius));
+        check("featherMask update", feathered, Reference::featherMask(featherSource, radius), 0);
+
+#ifdef CENSORME_HAVE_ZLIB
+        static const int pngColorTypes[] = { PngGray, PngGrayAlpha, PngRgb, PngRgba };
+        mismatches += checkPngRoundTrip(rng, size, pngColorTypes[i % 4]);
+#endif
+    }
+
+#ifdef CENSORME_HAVE_ZLIB
+    // Past the random sizes: one pixel, many blocks of rows, and rows of more than the
+    // encoder's 512 KiB blocks, so that every block is a single row
+    for (int colorType : { PngGray, PngGrayAlpha, PngRgb, PngRgba }) {
+        for (QSize pngSize : { QSize(1, 1), QSize(611, 1237), QSize(140001, 3) }) {
+            mismatches += checkPngRoundTrip(rng, pngSize, colorType);
+        }
+    }
+#endif
+
+    std::fprintf(stderr, "%d mismatches\n", mismatches);
+    return mismatches;
+}
+
+} // namespace KernelSelfCheck
@@ -0,0 +1,27 @@
+#ifndef KERNELSELFCHECK_H
+#define KERNELSELFCHECK_H
+
+#include <QtGlobal>
+
+// Differential check of the optimized CensorKernels against reference implementations,
+// over random odd-sized images in every QImage format, random chunk sizes, masks,
+// sub-rects, downscale sizes and feather radii. pixelize and mixdown are checked against
+// the QPainter pipeline they replaced, the rest against plain scalar code; featherMask
+// against an exhaustive nearest-pixel search, for full passes, sub-rects and updates
+// after an edit. pixelizeSpans and fillSpans along random shapes must equal pixelize()
+// and a fill wherever the shapes' mask is set. With zlib, PngEncoder output is read back
+// by Qt's PNG reader, in every colour type, as one block, many blocks and rows wider
+// than a block. Only built with CENSORME_KERNEL_SELFCHECK, and run as
+// `CensorMe --verify-kernels [iterations] [seed]`.
+//
+// Per channel, native formats must match bit for bit, except mixdown, where QPainter
+// rounds twice and may be off by one. Formats the kernels convert first may be off by
+// one more, since Qt's conversion and QImage::pixel() round differently.
+namespace KernelSelfCheck {
+
+// Prints every mismatch to stderr, returns how many there were
+int run(int iterations, quint32 seed);
+
+} // namespace KernelSelfCheck
+
+#endif // KERNELSELFCHECK_H
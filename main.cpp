@@ -1,9 +1,173 @@
 #include "mainwindow.h"
 
+#include "archiveexport.h"
+#include "censorrender.h"
+#include "censorserver.h"
+#include "taskscheduler.h"
+#include "watchservice.h"
 #include <QApplication>
+#include <QCommandLineParser>
+#include <QDir>
+#include <QFileInfo>
+#include <QThread>
+#include <cstdio>
+#ifdef CENSORME_KERNEL_SELFCHECK
+#include "kernelselfcheck.h"
+#include <random>
+#endif
+
+// Full rendition plus the comma separated extras, false after reporting an unknown one
+static bool parseRenditions(const QString &names, QVector<ExportRendition> &renditions)
+{
+    renditions = { ExportRenditions::full() };
+    for (const auto &name : names.split(',', Qt::SkipEmptyParts)) {
+        ExportRendition rendition;
+        if (!ExportRenditions::byName(name.trimmed(), rendition)) {
+            std::fprintf(stderr, "Unknown rendition: %s\n", qPrintable(name));
+            return false;
+        }
+        if (!rendition.name.isEmpty()) renditions.append(rendition);
+    }
+    return true;
+}
+
+// CensorMe --export-archive <archive.tar> [--renditions web,thumbnail] <image or folder>...
+static int runArchiveExport(const QCoreApplication &app)
+{
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Exports censored images into a single tar archive, using their saved masks.");
+    parser.addHelpOption();
+    QCommandLineOption archiveOption("export-archive", "Tar archive to write.", "archive");
+    QCommandLineOption renditionsOption("renditions", "Extra renditions to include: web, thumbnail.", "names");
+    parser.addOption(archiveOption);
+    parser.addOption(renditionsOption);
+    parser.addPositionalArgument("inputs", "Images, or folders of images.", "<image or folder>...");
+    parser.process(app);
+
+    QStringList images;
+    for (const auto &input : parser.positionalArguments()) {
+        QFileInfo fi(input);
+        if (fi.isDir()) {
+            images << CensorRender::imageFiles(fi.absoluteFilePath());
+        } else {
+            images << fi.absoluteFilePath();
+        }
+    }
+    if (images.isEmpty()) {
+        std::fprintf(stderr, "No images to export\n");
+        return 2;
+    }
+
+    QVector<ExportRendition> renditions;
+    if (!parseRenditions(parser.value(renditionsOption), renditions)) {
+        return 2;
+    }
+
+    QStringList skipped;
+    QString error;
+    bool ok = ArchiveExport::exportImages(images, renditions, parser.value(archiveOption), nullptr, skipped, error);
+    for (const auto &file : skipped) {
+        std::fprintf(stderr, "Skipped %s\n", qPrintable(file));
+    }
+    if (!ok) {
+        std::fprintf(stderr, "Export failed: %s\n", qPrintable(error));
+        return 1;
+    }
+    return skipped.isEmpty() ? 0 : 1;
+}
+
+// CensorMe --watch <folder> [--output <dir>] [--jobs N] [--renditions web,thumbnail]
+static int runWatchService(QCoreApplication &app)
+{
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Keeps censored exports of a folder tree up to date as masks are saved.");
+    parser.addHelpOption();
+    QCommandLineOption watchOption("watch", "Folder tree to watch.", "folder");
+    QCommandLineOption outputOption("output", "Where exports go, <folder>/output by default.", "dir");
+    QCommandLineOption jobsOption("jobs", "Images rendered at the same time.", "count",
+                                  QString::number(QThread::idealThreadCount()));
+    QCommandLineOption renditionsOption("renditions", "Extra renditions to write: web, thumbnail.", "names");
+    parser.addOption(watchOption);
+    parser.addOption(outputOption);
+    parser.addOption(jobsOption);
+    parser.addOption(renditionsOption);
+    parser.process(app);
+
+    const auto root = QDir(parser.value(watchOption)).absolutePath();
+    const auto output = parser.isSet(outputOption) ? parser.value(outputOption) : root + "/output";
+    QVector<ExportRendition> renditions;
+    if (!parseRenditions(parser.value(renditionsOption), renditions)) {
+        return 2;
+    }
+
+    WatchService service(root, output, renditions, parser.value(jobsOption).toInt());
+    QObject::connect(&service, &WatchService::rendered, [](const QString &source, double seconds) {
+        std::printf("%s %.0f ms\n", qPrintable(source), seconds * 1000);
+        std::fflush(stdout);
+    });
+    QObject::connect(&service, &WatchService::failed, [](const QString &source) {
+        std::fprintf(stderr, "Failed %s\n", qPrintable(source));
+    });
+    if (!service.start()) {
+        std::fprintf(stderr, "Not a folder: %s\n", qPrintable(root));
+        return 2;
+    }
+    return app.exec();
+}
+
+// CensorMe --serve <name> [--jobs N]
+static int runCensorServer(QCoreApplication &app)
+{
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Censors images for other processes over a local socket.");
+    parser.addHelpOption();
+    QCommandLineOption serveOption("serve", "Local socket name to listen on.", "name");
+    QCommandLineOption jobsOption("jobs", "Requests rendered at the same time.", "count",
+                                  QString::number(QThread::idealThreadCount()));
+    parser.addOption(serveOption);
+    parser.addOption(jobsOption);
+    parser.process(app);
+
+    // Nothing else runs in this process, the shared workers are all for requests
+    TaskScheduler::configure(parser.value(jobsOption).toInt(), false);
+    CensorServer server;
+    QObject::connect(&server, &CensorServer::served, [](const QString &id, bool ok, double latencyMs) {
+        std::printf("%s %s %.1f ms\n", qPrintable(id), ok ? "ok" : "failed", latencyMs);
+        std::fflush(stdout);
+    });
+    if (!server.listen(parser.value(serveOption))) {
+        std::fprintf(stderr, "Cannot listen on %s: %s\n", qPrintable(parser.value(serveOption)),
+                     qPrintable(server.errorString()));
+        return 2;
+    }
+    return app.exec();
+}
 
 int main(int argc, char *argv[])
 {
+#ifdef CENSORME_KERNEL_SELFCHECK
+    // Headless, exits non-zero on any mismatch: --verify-kernels [iterations] [seed]
+    if (argc > 1 && qstrcmp(argv[1], "--verify-kernels") == 0) {
+        int iterations = argc > 2 ? atoi(argv[2]) : 1000;
+        quint32 seed = argc > 3 ? quint32(strtoul(argv[3], nullptr, 10)) : std::random_device{}();
+        return KernelSelfCheck::run(iterations, seed) == 0 ? 0 : 1;
+    }
+#endif
+
+    // Headless, no window is ever created
+    if (argc > 1 && qstrcmp(argv[1], "--export-archive") == 0) {
+        QCoreApplication a(argc, argv);
+        return runArchiveExport(a);
+    }
+    if (argc > 1 && qstrcmp(argv[1], "--watch") == 0) {
+        QCoreApplication a(argc, argv);
+        return runWatchService(a);
+    }
+    if (argc > 1 && qstrcmp(argv[1], "--serve") == 0) {
+        QCoreApplication a(argc, argv);
+        return runCensorServer(a);
+    }
+
     QApplication a(argc, argv);
     MainWindow w;
     w.show();
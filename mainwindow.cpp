@@ -1,6 +1,11 @@
 #include "defs.h"
 #include "mainwindow.h"
 #include "./ui_mainwindow.h"
+#include "exportmanifest.h"
+#include "censorrender.h"
+#include "archiveexport.h"
+#include "maskbroadcast.h"
+#include <QApplication>
 #include <QFileDialog>
 #include <QMessageBox>
 #include <QDirIterator>
@@ -8,11 +13,20 @@
 #include <QJsonDocument>
 #include <QJsonObject>
 #include <QProgressDialog>
+#include <QColorDialog>
+#include <QStandardPaths>
 #include <QDebug>
 
+// Upper bound for the on-disk decoded image cache, enforced whenever it gets enabled
+static constexpr qint64 DecodedCacheMaxBytes = 4LL * 1024 * 1024 * 1024;
+// How much mask editing a crash can lose at most
+static constexpr int JournalFlushIntervalMs = 3000;
+
 MainWindow::MainWindow(QWidget *parent)
     : QMainWindow(parent)
     , ui(new Ui::MainWindow)
+    , m_decodedCache(QStandardPaths::writableLocation(QStandardPaths::CacheLocation) + QDir::separator() + "decoded",
+                     DecodedCacheMaxBytes)
 {
     ui->setupUi(this);
 
@@ -25,6 +39,14 @@ MainWindow::MainWindow(QWidget *parent)
     ui->statusbar->addWidget(ui_vline1);
     ui->statusbar->addWidget(ui_lblEdited);
 
+    ui_lblBuffers = new QLabel(this);
+    ui->statusbar->addPermanentWidget(ui_lblBuffers);
+    connect(ui->widCanvas, &CanvasWidget::bufferUsageChanged, [&](qint64 bytes, int allocations) {
+        ui_lblBuffers->setText(tr("Buffers: %1 MiB, %2 allocations")
+                               .arg(bytes / 1048576.0, 0, 'f', 1)
+                               .arg(allocations));
+    });
+
     ui->scrollArea->installEventFilter(ui->widCanvas); // Canvas needs to know resizes happened there
 
     m_previewModeGroup.addButton(ui->radPreviewOrig, PM_Original);
@@ -35,14 +57,27 @@ MainWindow::MainWindow(QWidget *parent)
     connect(&m_previewModeGroup, &QButtonGroup::idClicked, this, &MainWindow::previewModeButtonGroupIdClicked);
     ui->widCanvas->setPreviewMode(m_previewModeGroup.checkedId());
 
+    ui->cmbCensorMethod->setItemData(0, CT_Pixelize);
+    ui->cmbCensorMethod->setItemData(1, CT_White);
+    syncMethodControls({});
+
     m_fsModel.setFilter(QDir::Filter::Files | QDir::NoDotAndDotDot);
     m_fsModel.setNameFilters({"*.jpg", "*.jpeg", "*.png"});
     m_fsModel.setNameFilterDisables(false);
 
     ui->lstFileList->setModel(&m_fsModel);
-    ui->lstFileList->setSelectionMode(QListView::SingleSelection);
+    // Plain clicks open an image, Ctrl and Shift clicks only pick targets for Apply Mask to Selected
+    ui->lstFileList->setSelectionMode(QListView::ExtendedSelection);
     ui->lstFileList->setSelectionBehavior(QListView::SelectRows);
     connect(ui->lstFileList->selectionModel(), &QItemSelectionModel::currentChanged, this, &MainWindow::currentSelectedFileChanged);
+    // A plain click on an item made current by a Ctrl click doesn't change the current item
+    connect(ui->lstFileList, &QListView::clicked, [&](const QModelIndex &index) {
+        if (!m_folderModeFileNameNoDir.isEmpty() && index == ui->lstFileList->currentIndex() &&
+            index.row() != m_dirModeCurrentFileIndex &&
+            !(qApp->keyboardModifiers() & (Qt::ControlModifier | Qt::ShiftModifier))) {
+            loadListedFile(index, index);
+        }
+    });
 
     setOperatingInFolderMode(false);
 
@@ -51,10 +86,20 @@ MainWindow::MainWindow(QWidget *parent)
 
     m_autoSaveOnSwitching = ui->chkAutoSave->isChecked();
     connect(ui->chkAutoSave, &QCheckBox::stateChanged, [&](int s){ m_autoSaveOnSwitching = s; });
+
+    m_journalTimer.setInterval(JournalFlushIntervalMs);
+    connect(&m_journalTimer, &QTimer::timeout, this, &MainWindow::flushMaskJournal);
+    m_journalTimer.start();
+
+    m_indexerPending = 0;
 }
 
 MainWindow::~MainWindow()
 {
+    // Hashing jobs post back to this window
+    m_indexerCancel.cancel();
+    m_indexerTasks.wait();
+    m_hashIndex.save();
     delete ui;
 }
 
@@ -64,11 +109,37 @@ void MainWindow::previewModeButtonGroupIdClicked(int id)
 }
 
 void MainWindow::currentSelectedFileChanged(const QModelIndex &current, const QModelIndex &previous)
+{
+    // Extending the selection keeps the open image, it is the template the mask is copied from
+    if (!m_folderModeFileNameNoDir.isEmpty() && (qApp->keyboardModifiers() & (Qt::ControlModifier | Qt::ShiftModifier))) {
+        return;
+    }
+    loadListedFile(current, previous);
+}
+
+
+void MainWindow::openListedFile(const QModelIndex &index)
+{
+    // Switches made by the program don't look at held keys, e.g. the Ctrl of Ctrl+E
+    QModelIndex previous = ui->lstFileList->currentIndex();
+    disconnect(ui->lstFileList->selectionModel(), &QItemSelectionModel::currentChanged, this, &MainWindow::currentSelectedFileChanged);
+    ui->lstFileList->selectionModel()->setCurrentIndex(index, QItemSelectionModel::ClearAndSelect);
+    connect(ui->lstFileList->selectionModel(), &QItemSelectionModel::currentChanged, this, &MainWindow::currentSelectedFileChanged);
+    if (index.data().toString() != m_folderModeFileNameNoDir) {
+        loadListedFile(index, previous);
+    }
+}
+
+
+void MainWindow::loadListedFile(const QModelIndex &current, const QModelIndex &previous)
 {
     if (previous.isValid()) {
         if (!ensureSaved()) {
+            // previous may be an image only picked by a Ctrl click, go back to the open one
+            QModelIndex open = m_folderModeFileNameNoDir.isEmpty() ? previous :
+                               m_fsModel.index(m_dirModeDirAbsPath + QDir::separator() + m_folderModeFileNameNoDir);
             disconnect(ui->lstFileList->selectionModel(), &QItemSelectionModel::currentChanged, this, &MainWindow::currentSelectedFileChanged);
-            ui->lstFileList->setCurrentIndex(previous);
+            ui->lstFileList->selectionModel()->setCurrentIndex(open, QItemSelectionModel::ClearAndSelect);
             connect(ui->lstFileList->selectionModel(), &QItemSelectionModel::currentChanged, this, &MainWindow::currentSelectedFileChanged);
             m_folderModeFileNameNoDir = "";
             return;
@@ -77,7 +148,7 @@ void MainWindow::currentSelectedFileChanged(const QModelIndex &current, const QM
 
     QString file = m_dirModeDirAbsPath + QDir::separator() + m_fsModel.data(current).toString();
     qApp->setOverrideCursor(Qt::BusyCursor);
-    QImage img(file);
+    QImage img = m_decodedCache.load(file);
     if (img.isNull()) {
         qApp->restoreOverrideCursor();
         QMessageBox::critical(this, tr("Failed to load image"), tr("Probably is not supported format"));
@@ -93,14 +164,27 @@ void MainWindow::currentSelectedFileChanged(const QModelIndex &current, const QM
     } else {
         meta.method = CensorType::CT_Pixelize;
         meta.chunkSize = ui->sliderChunkSize->value();
+        meta.featherRadius = ui->sliderFeather->value();
     }
+    bool recovered = replayMaskJournal(file, mask, img.size(), meta.shapes);
+    bool unmasked = mask.isNull();
 
     m_censorMaskEdited = false;
     m_folderModeFileNameNoDir = m_fsModel.data(current).toString();
     m_dirModeCurrentFileIndex = current.row();
-    ui->widCanvas->switchImage(img, mask, meta);
+    ui->widCanvas->switchImage(std::move(img), std::move(mask), meta);
+    syncMethodControls(meta);
+    if (recovered) {
+        setCensorMaskEdited(true);
+    }
     ui->lblImgCounter->setText(tr("%1/%2").arg(current.row() + 1).arg(m_dirModeFileCount));
     qApp->restoreOverrideCursor();
+
+    // After the busy cursor is gone, it may ask a question
+    m_similarMaskCandidate.clear();
+    if (unmasked) {
+        offerSimilarMask(file);
+    }
 }
 
 void MainWindow::on_actOpenOneImg_triggered()
@@ -121,7 +205,7 @@ void MainWindow::on_actOpenOneImg_triggered()
     setCensorMaskEdited(false);
     m_fileModeFileAbsPath = file;
 
-    QImage img(file);
+    QImage img = m_decodedCache.load(file);
     if (img.isNull()) {
         QMessageBox::critical(this, tr("Failed to load image"), tr("Probably is not supported format"));
         return;
@@ -135,9 +219,20 @@ void MainWindow::on_actOpenOneImg_triggered()
     } else {
         meta.method = CensorType::CT_Pixelize;
         meta.chunkSize = ui->sliderChunkSize->value();
+        meta.featherRadius = ui->sliderFeather->value();
     }
+    bool recovered = replayMaskJournal(file, mask, img.size(), meta.shapes);
+    bool unmasked = mask.isNull();
 
-    ui->widCanvas->switchImage(img, mask, meta);
+    ui->widCanvas->switchImage(std::move(img), std::move(mask), meta);
+    syncMethodControls(meta);
+    if (recovered) {
+        setCensorMaskEdited(true);
+    }
+    m_similarMaskCandidate.clear();
+    if (unmasked) {
+        offerSimilarMask(file);
+    }
 }
 
 
@@ -148,6 +243,57 @@ void MainWindow::on_sliderChunkSize_sliderMoved(int position)
 }
 
 
+void MainWindow::on_sliderFeather_sliderMoved(int position)
+{
+    ui->widCanvas->setFeatherRadius(position);
+    ui->lblFeather->setText(position > 0 ? tr("%1px").arg(position) : tr("Off"));
+    setCensorMaskEdited(true);
+}
+
+
+void MainWindow::on_sliderFeather_sliderReleased()
+{
+    // The value the drag ended on, without waiting for the debounce
+    ui->widCanvas->applyFeatherRadius();
+}
+
+
+void MainWindow::on_cmbCensorMethod_activated(int index)
+{
+    auto type = (CensorType)ui->cmbCensorMethod->itemData(index).toInt();
+    ui->btnFillColor->setEnabled(type == CT_White);
+    ui->sliderChunkSize->setEnabled(type == CT_Pixelize);
+    if (type == ui->widCanvas->getCensorType()) return;
+
+    ui->widCanvas->setCensorType(type);
+    setCensorMaskEdited(true);
+}
+
+
+void MainWindow::on_btnFillColor_clicked()
+{
+    auto color = QColorDialog::getColor(ui->widCanvas->getFillColor(), this, tr("Select fill color"));
+    if (!color.isValid() || color == ui->widCanvas->getFillColor()) return;
+
+    ui->widCanvas->setFillColor(color);
+    syncMethodControls({ui->sliderChunkSize->value(), ui->widCanvas->getCensorType(), color, ui->sliderFeather->value()});
+    setCensorMaskEdited(true);
+}
+
+
+void MainWindow::on_cmbMaskTool_activated(int index)
+{
+    // Items are in CanvasWidget::Tool order
+    ui->widCanvas->setTool((CanvasWidget::Tool)index);
+}
+
+
+void MainWindow::on_chkSnapToChunks_toggled(bool checked)
+{
+    ui->widCanvas->setSnapShapesToChunks(checked);
+}
+
+
 void MainWindow::on_sliderBrushSize_sliderMoved(int position)
 {
     ui->widCanvas->setBrushSize(position);
@@ -171,6 +317,7 @@ void MainWindow::on_actOpenFolder_triggered()
     setOperatingInFolderMode(true);
     setCensorMaskEdited(false);
     m_dirModeDirAbsPath = folder;
+    startHashIndexer(folder);
 
     m_fsModel.setRootPath(folder);
     auto rootIdx = m_fsModel.index(folder);
@@ -192,7 +339,8 @@ void MainWindow::on_actOpenFolder_triggered()
 
     m_fsModel.sort(0);
     auto firstFile = m_fsModel.index(0, 0, rootIdx);
-    ui->lstFileList->setCurrentIndex(firstFile);
+    m_folderModeFileNameNoDir = ""; // May name a file of the previous folder
+    openListedFile(firstFile);
 
 //    QDirIterator dit(folder, {"*.jpg", "*.jpeg", "*.png"}, QDir::Filter::Files | QDir::NoDotAndDotDot);
 //    QStringList fileList;
@@ -215,28 +363,12 @@ void MainWindow::setOperatingInFolderMode(bool isInFolderMode)
 
 bool MainWindow::takeMaskAndMetadataForImage(QString absPath, QImage &maskOut, MetaConfig &metaOut)
 {
-    QFileInfo fi(absPath);
-    QString dataBaseDir = fi.dir().absolutePath() +
-                     QDir::separator() +
-                     CensorMeDataDir +
-                     QDir::separator();
-    maskOut = QImage(dataBaseDir + fi.fileName());
-
-    do {
-        QFile f(dataBaseDir + fi.fileName() + ".json");
-        if (!f.open(QFile::ReadOnly)) break;
-        QJsonParseError pe;
-        auto jsd = QJsonDocument::fromJson(f.readAll(), &pe);
-        if (pe.error != QJsonParseError::NoError) break;
-        if (!jsd.isObject()) break;
-        auto obj = jsd.object();
-        metaOut.method = (CensorType)obj["method"].toInt(0);
-        metaOut.chunkSize = std::clamp(obj["chunkSize"].toInt(15), 2, 200);
-
-        return true;
-    } while (false);
+    return CensorRender::loadSidecar(absPath, maskOut, metaOut);
+}
 
-    return false;
+QString MainWindow::sidecarBasePath(const QString &imageAbsPath)
+{
+    return CensorRender::sidecarBasePath(imageAbsPath);
 }
 
 void MainWindow::reloadMaskAndMetadataForImage()
@@ -258,7 +390,9 @@ void MainWindow::reloadMaskAndMetadataForImage()
         meta.chunkSize = 15;
     }
 
-    ui->widCanvas->restoreChanges(mask, meta);
+    ui->widCanvas->restoreChanges(std::move(mask), meta);
+    syncMethodControls(meta);
+    discardMaskJournal();
 }
 
 bool MainWindow::isAnyImageOpened()
@@ -305,11 +439,12 @@ bool MainWindow::saveForFileModeEditedFile()
     }
 
 retrySaveMask:
-    if (!ui->widCanvas->getMaskImage().save(fi.dir().absolutePath() +
-                                            QDir::separator() +
-                                            CensorMeDataDir +
-                                            QDir::separator() +
-                                            fi.fileName() + ".png")) {
+    if (!CensorRender::saveMask(ui->widCanvas->getMaskImage(),
+                                fi.dir().absolutePath() +
+                                QDir::separator() +
+                                CensorMeDataDir +
+                                QDir::separator() +
+                                fi.fileName() + ".png")) {
         auto ret = QMessageBox::critical(this,
                                          tr("Cannot save mask image"),
                                          tr("Please check permission, disk space or other things that may cause this problem!"),
@@ -322,11 +457,7 @@ retrySaveMask:
         }
     }
 
-    QJsonObject ro;
-    ro["method"] = ui->widCanvas->getCensorType();
-    ro["chunkSize"] = ui->sliderChunkSize->value();
-    QJsonDocument jsd(ro);
-    QString meta = jsd.toJson(QJsonDocument::Compact);
+    QString meta = CensorRender::sidecarJson(currentMetaConfig());
     bool success = false;
 
 retrySaveMeta:
@@ -356,6 +487,7 @@ retrySaveMeta:
         }
     }
 
+    discardMaskJournal(); // Compacted into the sidecar just written
     setCensorMaskEdited(false);
     return true;
 }
@@ -375,7 +507,7 @@ bool MainWindow::saveForFolderModeEditedFile(QString filename)
 
 
 retrySaveMask:
-    if (!ui->widCanvas->getMaskImage().save(maskDir.absolutePath() + QDir::separator() + filename + ".png")) {
+    if (!CensorRender::saveMask(ui->widCanvas->getMaskImage(), maskDir.absolutePath() + QDir::separator() + filename + ".png")) {
         auto ret = QMessageBox::critical(this,
                                          tr("Cannot save mask image"),
                                          tr("Please check permission, disk space or other things that may cause this problem!"),
@@ -388,11 +520,7 @@ retrySaveMask:
         }
     }
 
-    QJsonObject ro;
-    ro["method"] = ui->widCanvas->getCensorType();
-    ro["chunkSize"] = ui->sliderChunkSize->value();
-    QJsonDocument jsd(ro);
-    QString meta = jsd.toJson(QJsonDocument::Compact);
+    QString meta = CensorRender::sidecarJson(currentMetaConfig());
     bool success = false;
 
 retrySaveMeta:
@@ -418,12 +546,16 @@ retrySaveMeta:
         }
     }
 
+    discardMaskJournal(); // Compacted into the sidecar just written
     setCensorMaskEdited(false);
     return true;
 }
 
 void MainWindow::exportTo(QString dir)
 {
+    // Don't export a preview-quality approximation
+    ui->widCanvas->flushPendingRecompute();
+
     QDir exportDir(dir);
 
     if (!exportDir.exists()) {
@@ -435,7 +567,12 @@ void MainWindow::exportTo(QString dir)
         }
     }
 
-    QMessageBox::StandardButton choice;
+    // Outputs whose inputs are unchanged since the last export into this directory are skipped
+    ExportManifest manifest(exportDir.absolutePath());
+    manifest.load();
+    const auto params = exportParameters();
+
+    QMessageBox::StandardButton choice = QMessageBox::NoButton;
     if (m_isNowOperatingInFolderMode) {
         QProgressDialog pd(this);
         pd.setMinimumDuration(0);
@@ -448,12 +585,29 @@ void MainWindow::exportTo(QString dir)
         forever {
             auto fileIndex = m_fsModel.index(i, 0, rootIndex);
             if (!fileIndex.isValid()) break;
+            auto fileName = fileIndex.data().toString();
+            auto source = m_dirModeDirAbsPath + QDir::separator() + fileName;
+
+            // Unsaved edits on the open image aren't in its sidecar yet, never skip or record those
+            bool hasUnsavedEdits = m_censorMaskEdited && fileName == m_folderModeFileNameNoDir;
+            auto fingerprint = ExportManifest::fingerprint(source, sidecarBasePath(source), params);
+            if (!hasUnsavedEdits && isExportUpToDate(manifest, fileName, fingerprint)) {
+                i++;
+                pd.setValue(i);
+                continue;
+            }
+
             // Select file
-            ui->lstFileList->setCurrentIndex(fileIndex);
+            openListedFile(fileIndex);
+            if (m_folderModeFileNameNoDir != fileName) {
+                // Switching was refused (e.g. unsaved edits without autosave), canvas holds another image
+                break;
+            }
             // Export
-            exportImageConfirmOverwrite(ui->widCanvas->getFinalImage(),
-                                        dir + QDir::separator() + fileIndex.data().toString(),
-                                        choice);
+            auto written = exportRenditions(source, dir, fileName, choice);
+            for (const auto &output : written) {
+                if (!hasUnsavedEdits) manifest.record(output, fingerprint);
+            }
             switch (choice) {
             default:
             case QMessageBox::Yes:
@@ -473,13 +627,69 @@ void MainWindow::exportTo(QString dir)
     abortExport:
         pd.close();
     } else {
-        exportImageConfirmOverwrite(ui->widCanvas->getFinalImage(),
-                                    dir + QDir::separator() + QFileInfo(m_fileModeFileAbsPath).fileName(),
-                                    choice);
+        auto fileName = QFileInfo(m_fileModeFileAbsPath).fileName();
+        auto fingerprint = ExportManifest::fingerprint(m_fileModeFileAbsPath, sidecarBasePath(m_fileModeFileAbsPath), params);
+        if (!m_censorMaskEdited && isExportUpToDate(manifest, fileName, fingerprint)) {
+            return;
+        }
+        auto written = exportRenditions(m_fileModeFileAbsPath, dir, fileName, choice);
+        for (const auto &output : written) {
+            if (!m_censorMaskEdited) manifest.record(output, fingerprint);
+        }
+    }
+
+    if (!manifest.save()) {
+        qWarning() << "Cannot write export manifest in" << dir;
     }
 }
 
-void MainWindow::exportImageConfirmOverwrite(QImage image, QString dest, QMessageBox::StandardButton &choice)
+QJsonObject MainWindow::exportParameters()
+{
+    return CensorRender::exportParameters(activeExportRenditions());
+}
+
+QVector<ExportRendition> MainWindow::activeExportRenditions()
+{
+    QVector<ExportRendition> renditions = { ExportRenditions::full() };
+    if (ui->actExportWebSize->isChecked()) renditions.append(ExportRenditions::web());
+    if (ui->actExportThumbnails->isChecked()) renditions.append(ExportRenditions::thumbnail());
+    return renditions;
+}
+
+bool MainWindow::isExportUpToDate(const ExportManifest &manifest, const QString &fileName, const QString &fingerprint)
+{
+    for (const auto &rendition : activeExportRenditions()) {
+        if (!manifest.isUpToDate(ExportRenditions::outputName(fileName, rendition), fingerprint)) return false;
+    }
+    return true;
+}
+
+QStringList MainWindow::exportRenditions(const QString &source, const QString &dir, const QString &fileName,
+                                         QMessageBox::StandardButton &choice)
+{
+    // All sizes come from the frame the canvas already composited
+    const auto renditions = activeExportRenditions();
+    const auto images = ExportRenditions::render(ui->widCanvas->getFinalImage(), renditions);
+
+    QStringList written;
+    for (int i = 0; i < renditions.size(); i++) {
+        // A plain Yes/No only covers the one file it was asked about
+        if (choice == QMessageBox::Yes || choice == QMessageBox::No) {
+            choice = QMessageBox::NoButton;
+        }
+
+        auto outputName = ExportRenditions::outputName(fileName, renditions[i]);
+        auto dest = dir + QDir::separator() + outputName;
+        QDir().mkpath(QFileInfo(dest).absolutePath());
+        if (exportImageConfirmOverwrite(images[i], source, dest, renditions[i].quality, choice)) {
+            written << outputName;
+        }
+        if (choice == QMessageBox::Abort) break;
+    }
+    return written;
+}
+
+bool MainWindow::exportImageConfirmOverwrite(const QImage &image, QString source, QString dest, int quality, QMessageBox::StandardButton &choice)
 {
     QMessageBox::StandardButton newChoice = QMessageBox::Yes;
     if (QFile::exists(dest)) {
@@ -506,19 +716,34 @@ void MainWindow::exportImageConfirmOverwrite(QImage image, QString dest, QMessag
 
     if (stillWrite) {
 retryExport:
-        if (!image.save(dest, nullptr, 30)) {
+        if (!saveExportedImage(image, source, dest, quality)) {
             auto ret = QMessageBox::critical(nullptr,
                                              tr("Cannot save exported file"),
                                              tr("Please check permission, disk space or other things that may cause this problem!"),
                                              QMessageBox::Abort | QMessageBox::Retry | QMessageBox::Ignore);
             switch (ret) {
             default:
-            case QMessageBox::Abort: choice = QMessageBox::Abort; return;
+            case QMessageBox::Abort: choice = QMessageBox::Abort; return false;
             case QMessageBox::Retry: goto retryExport;
-            case QMessageBox::Ignore: break;
+            case QMessageBox::Ignore: return false;
             }
         }
     }
+    return stillWrite;
+}
+
+bool MainWindow::saveExportedImage(const QImage &image, const QString &source, const QString &dest, int quality)
+{
+    auto encoded = CensorRender::encode(image, ui->widCanvas->getCensorMask(), source, dest, quality);
+    if (encoded.isEmpty()) {
+        return false;
+    }
+
+    QFile f(dest);
+    if (!f.open(QFile::WriteOnly)) {
+        return false;
+    }
+    return f.write(encoded) == encoded.size();
 }
 
 
@@ -532,6 +757,143 @@ void MainWindow::switchToImage(QString absPath)
 
 }
 
+MetaConfig MainWindow::currentMetaConfig()
+{
+    return { ui->sliderChunkSize->value(), ui->widCanvas->getCensorType(),
+             ui->widCanvas->getFillColor(), ui->sliderFeather->value(), ui->widCanvas->getShapes() };
+}
+
+void MainWindow::syncMethodControls(const MetaConfig &meta)
+{
+    ui->cmbCensorMethod->setCurrentIndex(std::max(0, ui->cmbCensorMethod->findData(meta.method)));
+    ui->btnFillColor->setEnabled(meta.method == CT_White);
+    ui->sliderChunkSize->setEnabled(meta.method == CT_Pixelize);
+
+    QPixmap swatch(16, 16);
+    swatch.fill(meta.fillColor);
+    ui->btnFillColor->setIcon(swatch);
+
+    ui->sliderFeather->setSliderPosition(meta.featherRadius);
+    ui->lblFeather->setText(meta.featherRadius > 0 ? tr("%1px").arg(meta.featherRadius) : tr("Off"));
+}
+
+void MainWindow::startHashIndexer(const QString &folder)
+{
+    // Results still coming in for the previous folder are dropped
+    m_indexerCancel.cancel();
+    m_indexerCancel = TaskScheduler::CancelToken();
+    m_indexerPending = 0;
+    m_similarMaskCandidate.clear();
+    m_hashIndex.save();
+    m_hashIndex.setFolder(folder);
+    m_hashIndex.load();
+
+    const auto token = m_indexerCancel;
+    for (const auto &path : CensorRender::imageFiles(folder)) {
+        auto fileName = QFileInfo(path).fileName();
+        quint64 hash;
+        QSize size;
+        if (m_hashIndex.lookup(fileName, hash, size)) continue;
+
+        m_indexerPending++;
+        // Yields to canvas recomputes, which is all the editor does meanwhile
+        TaskScheduler::instance().submit(TaskScheduler::Prefetch, [this, token, path, fileName]() {
+            quint64 hash = 0;
+            QSize size;
+            bool ok = PerceptualHash::hashFile(path, hash, size);
+            QMetaObject::invokeMethod(this, [=]() {
+                if (token.isCanceled()) return;
+                if (ok) m_hashIndex.insert(fileName, hash, size);
+                if (--m_indexerPending == 0) m_hashIndex.save();
+                // The open image was waiting for this hash, unless it has been edited since
+                if (path == m_similarMaskCandidate) {
+                    m_similarMaskCandidate.clear();
+                    if (ok && !m_censorMaskEdited) offerSimilarMask(path);
+                }
+            }, Qt::QueuedConnection);
+        }, token, &m_indexerTasks);
+    }
+}
+
+void MainWindow::offerSimilarMask(const QString &imageAbsPath)
+{
+    if (!ui->actSuggestSimilarMasks->isChecked()) return;
+
+    // A single image is matched against its folder's index, if one was ever built
+    QFileInfo fi(imageAbsPath);
+    PerceptualHashIndex folderIndex;
+    PerceptualHashIndex *index = &m_hashIndex;
+    if (m_hashIndex.folder() != fi.absolutePath()) {
+        folderIndex.setFolder(fi.absolutePath());
+        folderIndex.load();
+        index = &folderIndex;
+    }
+
+    // Hashing here would decode the image a second time on the GUI thread. If the indexer
+    // hasn't got to it yet, the offer waits for it; a folder nobody indexes gets none.
+    quint64 hash;
+    QSize size;
+    if (!index->lookup(fi.fileName(), hash, size)) {
+        if (index == &m_hashIndex && m_indexerPending > 0) {
+            m_similarMaskCandidate = fi.absoluteFilePath();
+        }
+        return;
+    }
+    auto match = index->findMaskedMatch(fi.fileName(), hash, size);
+    if (match.isEmpty()) return;
+
+    auto ret = QMessageBox::question(this,
+                                     tr("Reuse a similar mask?"),
+                                     tr("This image looks like %1, which already has a saved mask.\n"
+                                        "Start from that mask?").arg(QFileInfo(match).fileName()));
+    if (ret != QMessageBox::Yes) return;
+
+    QImage mask;
+    MetaConfig meta = currentMetaConfig();
+    CensorRender::loadSidecar(match, mask, meta);
+    if (mask.isNull()) return;
+
+    ui->sliderChunkSize->setSliderPosition(meta.chunkSize);
+    on_sliderChunkSize_sliderMoved(meta.chunkSize);
+    ui->widCanvas->restoreChanges(std::move(mask), meta);
+    syncMethodControls(meta);
+    setCensorMaskEdited(true);
+}
+
+void MainWindow::flushMaskJournal()
+{
+    if (!isAnyImageOpened()) return;
+
+    // Whatever couldn't be written stays dirty and is tried again on the next flush
+    auto tiles = ui->widCanvas->takeDirtyMaskTiles();
+    if (!tiles.isEmpty() && !m_maskJournal.append(ui->widCanvas->getMaskImage(), tiles)) {
+        qWarning() << "Cannot append to mask journal" << m_maskJournal.path();
+        ui->widCanvas->remarkDirtyMaskTiles(tiles);
+    }
+    if (ui->widCanvas->takeShapesEdited() &&
+        !m_maskJournal.appendShapes(ui->widCanvas->getMaskImage().size(), ui->widCanvas->getShapes())) {
+        qWarning() << "Cannot append to mask journal" << m_maskJournal.path();
+        ui->widCanvas->remarkShapesEdited();
+    }
+}
+
+void MainWindow::discardMaskJournal()
+{
+    ui->widCanvas->takeDirtyMaskTiles();
+    ui->widCanvas->takeShapesEdited();
+    m_maskJournal.discard();
+}
+
+bool MainWindow::replayMaskJournal(const QString &imageAbsPath, QImage &mask, QSize imageSize, QVector<MaskShape> &shapes)
+{
+    // Edits that never made it into the sidecar, e.g. because the app crashed
+    m_maskJournal.setPath(sidecarBasePath(imageAbsPath) + ".journal");
+    if (!m_maskJournal.replay(mask, imageSize, shapes)) return false;
+
+    ui->statusbar->showMessage(tr("Recovered unsaved mask edits"), 5000);
+    return true;
+}
+
 void MainWindow::setCensorMaskEdited(bool edited)
 {
     if (!isAnyImageOpened()) return;
@@ -588,11 +950,148 @@ void MainWindow::on_actExportSelectDest_triggered()
 }
 
 
+void MainWindow::on_actExportArchive_triggered()
+{
+    if (!isAnyImageOpened()) return;
+
+    // Images are rendered from their sidecars, unsaved edits have to be in there first
+    if (!ensureSaved()) return;
+
+    QString baseDir = m_isNowOperatingInFolderMode ? m_dirModeDirAbsPath : QFileInfo(m_fileModeFileAbsPath).dir().absolutePath();
+    auto archive = QFileDialog::getSaveFileName(this,
+                                                tr("Export to archive..."),
+                                                baseDir + QDir::separator() + "output.tar",
+                                                tr("Tar archive (*.tar)"));
+    if (archive.isEmpty()) return;
+
+    QStringList images = m_isNowOperatingInFolderMode ? CensorRender::imageFiles(m_dirModeDirAbsPath) :
+                                                        QStringList{ m_fileModeFileAbsPath };
+    QProgressDialog pd(this);
+    pd.setMinimumDuration(0);
+    pd.setMaximum(images.size());
+    pd.setWindowModality(Qt::WindowModal);
+    pd.show();
+
+    QStringList skipped;
+    QString error;
+    bool ok = ArchiveExport::exportImages(images, activeExportRenditions(), archive, [&](int done) {
+        pd.setValue(done);
+        return !pd.wasCanceled();
+    }, skipped, error);
+    pd.close();
+
+    if (!ok) {
+        QMessageBox::critical(this, tr("Cannot export archive"), error);
+    } else if (!skipped.isEmpty()) {
+        QMessageBox::warning(this,
+                             tr("Some images were not exported"),
+                             tr("These could not be read or encoded:\n%1").arg(skipped.join("\n")));
+    }
+}
+
+
+void MainWindow::on_actApplyMaskToSelection_triggered()
+{
+    if (!m_isNowOperatingInFolderMode || m_folderModeFileNameNoDir.isEmpty()) return;
+
+    // The template is the image open in the canvas, not the last item clicked in the list
+    const QString templateName = m_folderModeFileNameNoDir;
+    const QImage templateMask = ui->widCanvas->getMaskImage();
+    const MetaConfig templateMeta = currentMetaConfig();
+
+    QVector<MaskBroadcast::Target> targets;
+    int replacing = 0;
+    for (const auto &index : ui->lstFileList->selectionModel()->selectedIndexes()) {
+        auto fileName = index.data().toString();
+        if (fileName == templateName) continue;
+        MaskBroadcast::Target target;
+        target.source = m_dirModeDirAbsPath + QDir::separator() + fileName;
+        if (QFileInfo::exists(sidecarBasePath(target.source) + ".png")) replacing++;
+        targets.append(target);
+    }
+    if (targets.isEmpty()) {
+        QMessageBox::information(this,
+                                 tr("No other images selected"),
+                                 tr("Hold Ctrl or Shift to select the images in the file list this mask should go to. "
+                                    "The open image stays open while you do."));
+        return;
+    }
+
+    QMessageBox box(QMessageBox::Question,
+                    tr("Apply mask to selected images"),
+                    tr("Give %1 selected images the mask and censor settings of %2?").arg(targets.size()).arg(templateName),
+                    QMessageBox::Cancel, this);
+    if (replacing > 0) {
+        box.setInformativeText(tr("%1 of them already have a mask, it will be replaced.").arg(replacing));
+    }
+    auto applyButton = box.addButton(tr("Apply"), QMessageBox::AcceptRole);
+    auto exportButton = box.addButton(tr("Apply && Export to \"output/\""), QMessageBox::AcceptRole);
+    box.exec();
+    if (box.clickedButton() != applyButton && box.clickedButton() != exportButton) return;
+
+    const QString outputDir = box.clickedButton() == exportButton ?
+                              m_dirModeDirAbsPath + QDir::separator() + "output" : QString();
+    QProgressDialog pd(this);
+    pd.setMinimumDuration(0);
+    pd.setMaximum(targets.size());
+    pd.setWindowModality(Qt::WindowModal);
+    pd.show();
+
+    // Images of a different size can't take a mask drawn in this one's pixels, they are skipped
+    bool ok = MaskBroadcast::apply(templateMask, templateMeta, targets, outputDir,
+                                   activeExportRenditions(), exportParameters(), [&](int done) {
+        pd.setValue(done);
+        return !pd.wasCanceled();
+    });
+    pd.close();
+    if (!ok) {
+        QMessageBox::critical(this, tr("Cannot apply mask"), tr("The mask could not be encoded."));
+        return;
+    }
+
+    if (!outputDir.isEmpty()) {
+        ExportManifest manifest(outputDir);
+        manifest.load();
+        for (const auto &target : targets) {
+            if (!target.error.isEmpty()) continue;
+            for (const auto &output : target.outputs) {
+                manifest.record(output, target.fingerprint);
+            }
+        }
+        if (!manifest.save()) {
+            qWarning() << "Cannot write export manifest in" << outputDir;
+        }
+    }
+
+    QStringList skipped;
+    for (const auto &target : targets) {
+        if (!target.error.isEmpty()) {
+            skipped.append(QFileInfo(target.source).fileName() + ": " + target.error);
+        }
+    }
+    if (!skipped.isEmpty()) {
+        QMessageBox::warning(this,
+                             tr("Some images were skipped"),
+                             tr("The mask was applied to %1 of %2 images. These were skipped:\n%3")
+                                 .arg(targets.size() - skipped.size()).arg(targets.size()).arg(skipped.join("\n")));
+    }
+}
+
+
+void MainWindow::on_actCacheDecodedImages_toggled(bool checked)
+{
+    m_decodedCache.setEnabled(checked);
+    if (checked) {
+        m_decodedCache.prune();
+    }
+}
+
+
 void MainWindow::on_btnPrevImg_clicked()
 {
     if (m_dirModeCurrentFileIndex == 0) return;
 
-    ui->lstFileList->setCurrentIndex(m_fsModel.index(m_dirModeCurrentFileIndex - 1, 0, ui->lstFileList->rootIndex()));
+    openListedFile(m_fsModel.index(m_dirModeCurrentFileIndex - 1, 0, ui->lstFileList->rootIndex()));
 }
 
 
@@ -600,6 +1099,5 @@ void MainWindow::on_btnNextImg_clicked()
 {
     if (m_dirModeCurrentFileIndex == m_dirModeFileCount - 1) return;
 
-    ui->lstFileList->setCurrentIndex(m_fsModel.index(m_dirModeCurrentFileIndex + 1, 0, ui->lstFileList->rootIndex()));
+    openListedFile(m_fsModel.index(m_dirModeCurrentFileIndex + 1, 0, ui->lstFileList->rootIndex()));
 }
-
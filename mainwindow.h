@@ -2,11 +2,19 @@
 #define MAINWINDOW_H
 
 #include "defs.h"
+#include "decodedimagecache.h"
+#include "maskjournal.h"
+#include "exportrenditions.h"
+#include "perceptualhash.h"
+#include "taskscheduler.h"
 #include <QMainWindow>
 #include <QButtonGroup>
 #include <QFileSystemModel>
 #include <QMessageBox>
 #include <QLabel>
+#include <QColor>
+#include <QJsonObject>
+#include <QTimer>
 
 QT_BEGIN_NAMESPACE
 namespace Ui {
@@ -14,10 +22,7 @@ class MainWindow;
 }
 QT_END_NAMESPACE
 
-struct MetaConfig {
-    int chunkSize;
-    CensorType method;
-};
+class ExportManifest;
 
 class MainWindow : public QMainWindow
 {
@@ -34,6 +39,16 @@ private slots:
     void on_actOpenOneImg_triggered();
 
     void on_sliderChunkSize_sliderMoved(int action);
+    void on_sliderFeather_sliderMoved(int position);
+    void on_sliderFeather_sliderReleased();
+
+    void on_cmbCensorMethod_activated(int index);
+
+    void on_btnFillColor_clicked();
+
+    void on_cmbMaskTool_activated(int index);
+
+    void on_chkSnapToChunks_toggled(bool checked);
 
     void on_sliderBrushSize_sliderMoved(int position);
 
@@ -49,27 +64,49 @@ private slots:
 
     void on_actExportSelectDest_triggered();
 
+    void on_actExportArchive_triggered();
+
+    void on_actApplyMaskToSelection_triggered();
+
+    void on_actCacheDecodedImages_toggled(bool checked);
+
     void on_btnPrevImg_clicked();
 
     void on_btnNextImg_clicked();
 
 private:
     void switchToImage(QString absPath);
+    MetaConfig currentMetaConfig();
+    void syncMethodControls(const MetaConfig &meta);
     void setCensorMaskEdited(bool);
+    void flushMaskJournal();
+    void discardMaskJournal();
+    bool replayMaskJournal(const QString &imageAbsPath, QImage &mask, QSize imageSize, QVector<MaskShape> &shapes);
+    void startHashIndexer(const QString &folder);
+    void offerSimilarMask(const QString &imageAbsPath);
+    void openListedFile(const QModelIndex &index);
+    void loadListedFile(const QModelIndex &current, const QModelIndex &previous);
     void setOperatingInFolderMode(bool);
     bool takeMaskAndMetadataForImage(QString absPath, QImage &maskOut, MetaConfig &metaOut);
+    static QString sidecarBasePath(const QString &imageAbsPath);
     void reloadMaskAndMetadataForImage();
     bool isAnyImageOpened();
     bool ensureSaved();
     bool saveForFileModeEditedFile();
     bool saveForFolderModeEditedFile(QString filenameNoDir);
     void exportTo(QString dir);
-    void exportImageConfirmOverwrite(QImage image, QString dest, QMessageBox::StandardButton &choice);
+    QJsonObject exportParameters();
+    QVector<ExportRendition> activeExportRenditions();
+    bool isExportUpToDate(const ExportManifest &manifest, const QString &fileName, const QString &fingerprint);
+    QStringList exportRenditions(const QString &source, const QString &dir, const QString &fileName, QMessageBox::StandardButton &choice);
+    bool exportImageConfirmOverwrite(const QImage &image, QString source, QString dest, int quality, QMessageBox::StandardButton &choice);
+    bool saveExportedImage(const QImage &image, const QString &source, const QString &dest, int quality);
 
 private:
     Ui::MainWindow *ui;
     QLabel* ui_lblPath;
     QLabel* ui_lblEdited;
+    QLabel* ui_lblBuffers;
     QFrame* ui_vline1;
 
     QString m_fileModeFileAbsPath;
@@ -83,5 +120,15 @@ private:
     bool m_isNowOperatingInFolderMode;
     bool m_censorMaskEdited;
     bool m_autoSaveOnSwitching;
+
+    DecodedImageCache m_decodedCache;
+    MaskJournal m_maskJournal;
+    QTimer m_journalTimer;
+
+    PerceptualHashIndex m_hashIndex;
+    TaskScheduler::CancelToken m_indexerCancel;
+    TaskScheduler::TaskGroup m_indexerTasks;
+    int m_indexerPending;
+    QString m_similarMaskCandidate; // Open image whose similar mask offer waits for the indexer
 };
 #endif // MAINWINDOW_H
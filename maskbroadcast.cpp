@@ -0,0 +1,123 @@
+#include "maskbroadcast.h"
+#include "censorrender.h"
+#include "exportmanifest.h"
+#include "taskscheduler.h"
+#include <QDir>
+#include <QFileInfo>
+#include <QImageReader>
+#include <QSaveFile>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+
+namespace {
+
+bool writeFile(const QString &path, const QByteArray &data)
+{
+    // Whoever reads the sidecars or the output tree never sees a half-written file
+    QSaveFile f(path);
+    return QDir().mkpath(QFileInfo(path).absolutePath()) &&
+           f.open(QFile::WriteOnly) &&
+           f.write(data) == data.size() &&
+           f.commit();
+}
+
+void applyOne(MaskBroadcast::Target &target, QSize maskSize, const QByteArray &png, const QByteArray &json,
+              const QString &outputDir, const QVector<ExportRendition> &renditions,
+              const QJsonObject &exportParams)
+{
+    // Only the header is read, the pixels are decoded again just for an export
+    const QSize size = QImageReader(target.source).size();
+    if (!size.isValid()) {
+        target.error = "Cannot read image";
+        return;
+    }
+    if (size != maskSize) {
+        target.error = QString("%1x%2 pixels, the mask is %3x%4")
+                           .arg(size.width()).arg(size.height())
+                           .arg(maskSize.width()).arg(maskSize.height());
+        return;
+    }
+
+    const auto sidecar = CensorRender::sidecarBasePath(target.source);
+    if (!writeFile(sidecar + ".png", png) || !writeFile(sidecar + ".json", json)) {
+        target.error = "Cannot write mask";
+        return;
+    }
+
+    if (!outputDir.isEmpty()) {
+        const auto fileName = QFileInfo(target.source).fileName();
+        QVector<QByteArray> encoded;
+        if (!CensorRender::renderFile(target.source, renditions, encoded)) {
+            target.error = "Mask saved, cannot export";
+            return;
+        }
+        for (int r = 0; r < renditions.size(); r++) {
+            auto name = ExportRenditions::outputName(fileName, renditions[r]);
+            if (!writeFile(outputDir + QDir::separator() + name, encoded[r])) {
+                target.error = "Mask saved, cannot write export";
+                return;
+            }
+            target.outputs.append(name);
+        }
+        target.fingerprint = ExportManifest::fingerprint(target.source, sidecar, exportParams);
+    }
+    target.error.clear();
+}
+
+} // namespace
+
+namespace MaskBroadcast {
+
+bool apply(const QImage &mask, const MetaConfig &meta, QVector<Target> &targets,
+           const QString &outputDir, const QVector<ExportRendition> &renditions,
+           const QJsonObject &exportParams, const std::function<bool(int)> &progress)
+{
+    // The same bytes go to every target, so they are encoded only once
+    const QByteArray png = CensorRender::encodeMask(mask);
+    if (png.isEmpty()) {
+        return false;
+    }
+    const QByteArray json = CensorRender::sidecarJson(meta);
+
+    std::mutex mutex;
+    std::condition_variable changed;
+    int done = 0;
+
+    TaskScheduler::CancelToken cancel;
+    TaskScheduler::TaskGroup group;
+    Target *items = targets.data(); // Detached here, workers each write only their own item
+    for (int i = 0; i < targets.size(); i++) {
+        items[i].error = "Canceled";
+        items[i].outputs.clear();
+        items[i].fingerprint.clear();
+        // Everything captured by reference outlives the tasks, group is waited for below
+        TaskScheduler::instance().submit(TaskScheduler::Export, [&, i]() {
+            applyOne(items[i], mask.size(), png, json, outputDir, renditions, exportParams);
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                done++;
+            }
+            changed.notify_one();
+        }, cancel, &group);
+    }
+
+    // Canceled tasks never run and never count, so stop waiting on them once canceled
+    bool canceled = false;
+    std::unique_lock<std::mutex> lock(mutex);
+    while (done < targets.size() && !canceled) {
+        changed.wait_for(lock, std::chrono::milliseconds(50));
+        const int reported = done;
+        lock.unlock();
+        if (progress && !progress(reported)) {
+            cancel.cancel();
+            canceled = true;
+        }
+        lock.lock();
+    }
+    lock.unlock();
+    group.wait();
+    return true;
+}
+
+} // namespace MaskBroadcast
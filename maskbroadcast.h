@@ -0,0 +1,35 @@
+#ifndef MASKBROADCAST_H
+#define MASKBROADCAST_H
+
+#include "defs.h"
+#include "exportrenditions.h"
+#include <QImage>
+#include <QJsonObject>
+#include <QString>
+#include <QStringList>
+#include <QVector>
+#include <functional>
+
+// Gives many images the same mask and settings at once, e.g. a fixed camera where the
+// same region has to go in every frame. Sidecars are written, and the images optionally
+// exported, in parallel on the shared scheduler.
+namespace MaskBroadcast {
+
+struct Target {
+    QString source;       // Absolute image path
+    QString error;        // Why it was skipped, empty once applied
+    QStringList outputs;  // Export output names written
+    QString fingerprint;  // Of the export inputs, with the new sidecar in place
+};
+
+// mask is in the targets' pixels; targets of any other size are skipped. With outputDir
+// set every applied target is also exported there in renditions, exportParams going into
+// its fingerprint. progress(done) runs on the calling thread and cancels targets that
+// haven't started by returning false. Returns false only if the mask can't be encoded.
+bool apply(const QImage &mask, const MetaConfig &meta, QVector<Target> &targets,
+           const QString &outputDir, const QVector<ExportRendition> &renditions,
+           const QJsonObject &exportParams, const std::function<bool(int)> &progress);
+
+} // namespace MaskBroadcast
+
+#endif // MASKBROADCAST_H
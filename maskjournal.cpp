@@ -0,0 +1,198 @@
+#include "maskjournal.h"
+#include "defs.h"
+#include "censorrender.h"
+#include "maskshapes.h"
+#include <QDataStream>
+#include <QDir>
+#include <QFileInfo>
+#include <QJsonDocument>
+#include <QtEndian>
+#include <functional>
+#ifdef Q_OS_WIN
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+namespace {
+
+constexpr quint32 JournalMagic = 0x434d4a31; // "CMJ1"
+constexpr int CompressionLevel = 1; // Tiles are mostly 0 or 255, fast is plenty
+constexpr quint16 ShapesRecord = 0xffff; // In place of both tile coordinates
+
+QRect tileRect(int tx, int ty, QSize maskSize)
+{
+    return QRect(tx * MaskTileSize, ty * MaskTileSize, MaskTileSize, MaskTileSize) & QRect(QPoint(0, 0), maskSize);
+}
+
+// flush() only hands the data to the OS, the journal must survive a power loss too
+bool syncToDisk(QFile &file)
+{
+    if (!file.flush()) return false;
+#ifdef Q_OS_WIN
+    return _commit(file.handle()) == 0;
+#else
+    return fsync(file.handle()) == 0;
+#endif
+}
+
+// Walks the records of a journal for a mask of maskSize. Returns the offset just past
+// the last complete record, or -1 when the header doesn't belong to such a mask.
+qint64 scanJournal(QIODevice &dev, QSize maskSize,
+                   const std::function<void(const QRect&, const QByteArray&)> &apply,
+                   const std::function<void(const QVector<MaskShape>&)> &applyShapes)
+{
+    QDataStream ds(&dev);
+    quint32 magic, width, height, tileSize;
+    ds >> magic >> width >> height >> tileSize;
+    if (ds.status() != QDataStream::Ok || magic != JournalMagic ||
+        int(width) != maskSize.width() || int(height) != maskSize.height() || int(tileSize) != MaskTileSize) {
+        return -1;
+    }
+
+    qint64 validEnd = dev.pos();
+    forever {
+        quint16 tx, ty;
+        quint32 length;
+        ds >> tx >> ty >> length;
+        if (ds.status() != QDataStream::Ok || length > dev.bytesAvailable()) break;
+
+        QByteArray compressed(int(length), Qt::Uninitialized);
+        if (ds.readRawData(compressed.data(), int(length)) != int(length)) break;
+
+        if (tx == ShapesRecord && ty == ShapesRecord) {
+            QJsonParseError pe;
+            auto doc = QJsonDocument::fromJson(qUncompress(compressed), &pe);
+            if (pe.error != QJsonParseError::NoError || !doc.isArray()) break;
+            if (applyShapes) applyShapes(MaskShapes::fromJson(doc.array()));
+            validEnd = dev.pos();
+            continue;
+        }
+
+        auto rect = tileRect(tx, ty, maskSize);
+        if (rect.isEmpty()) break;
+        // qCompress prefixes the uncompressed size, check it before trusting the payload
+        const int expected = rect.width() * rect.height();
+        if (length < 4 || qFromBigEndian<quint32>(compressed.constData()) != quint32(expected)) break;
+        auto alpha = qUncompress(compressed);
+        if (alpha.size() != expected) break;
+
+        if (apply) apply(rect, alpha);
+        validEnd = dev.pos();
+    }
+    return validEnd;
+}
+
+} // namespace
+
+void MaskJournal::setPath(const QString &path)
+{
+    m_file.close();
+    m_path = path;
+}
+
+bool MaskJournal::replay(QImage &mask, QSize imageSize, QVector<MaskShape> &shapes) const
+{
+    QFile f(m_path);
+    if (!f.open(QFile::ReadOnly)) return false;
+
+    // Records are in canvas coordinates, bring the mask to what the canvas would have
+    mask = CensorRender::adoptMask(std::move(mask), imageSize);
+
+    bool applied = false;
+    scanJournal(f, imageSize, [&](const QRect &rect, const QByteArray &alpha) {
+        auto src = reinterpret_cast<const uchar*>(alpha.constData());
+        for (int y = rect.top(); y <= rect.bottom(); y++) {
+            auto line = reinterpret_cast<QRgb*>(mask.scanLine(y)) + rect.left();
+            for (int x = 0; x < rect.width(); x++, src++) {
+                // The brush only ever paints white
+                line[x] = qRgba(*src, *src, *src, *src);
+            }
+        }
+        applied = true;
+    }, [&](const QVector<MaskShape> &logged) {
+        shapes = logged;
+        applied = true;
+    });
+    return applied;
+}
+
+bool MaskJournal::append(const QImage &mask, const QVector<QPoint> &tiles)
+{
+    if (tiles.isEmpty()) return true;
+    if (!openForAppend(mask.size())) return false;
+
+    // One write per batch keeps a crash from leaving more than one torn record behind
+    QByteArray batch;
+    QDataStream ds(&batch, QIODevice::WriteOnly);
+    QByteArray alpha;
+    for (const auto &tile : tiles) {
+        auto rect = tileRect(tile.x(), tile.y(), mask.size());
+        if (rect.isEmpty()) continue;
+
+        alpha.resize(rect.width() * rect.height());
+        auto dst = reinterpret_cast<uchar*>(alpha.data());
+        for (int y = rect.top(); y <= rect.bottom(); y++) {
+            auto line = reinterpret_cast<const QRgb*>(mask.constScanLine(y)) + rect.left();
+            for (int x = 0; x < rect.width(); x++) *dst++ = qAlpha(line[x]);
+        }
+
+        auto compressed = qCompress(alpha, CompressionLevel);
+        ds << quint16(tile.x()) << quint16(tile.y()) << quint32(compressed.size());
+        ds.writeRawData(compressed.constData(), compressed.size());
+    }
+
+    return writeRecords(batch);
+}
+
+bool MaskJournal::appendShapes(QSize maskSize, const QVector<MaskShape> &shapes)
+{
+    if (!openForAppend(maskSize)) return false;
+
+    auto compressed = qCompress(QJsonDocument(MaskShapes::toJson(shapes)).toJson(QJsonDocument::Compact), CompressionLevel);
+    QByteArray record;
+    QDataStream ds(&record, QIODevice::WriteOnly);
+    ds << ShapesRecord << ShapesRecord << quint32(compressed.size());
+    ds.writeRawData(compressed.constData(), compressed.size());
+    return writeRecords(record);
+}
+
+void MaskJournal::discard()
+{
+    m_file.close();
+    if (!m_path.isEmpty()) QFile::remove(m_path);
+}
+
+bool MaskJournal::writeRecords(const QByteArray &records)
+{
+    // Batches come every few seconds, so syncing each one costs little
+    if (m_file.write(records) == records.size() && syncToDisk(m_file)) return true;
+
+    // Part of it may have landed. Closing makes the next append reopen through
+    // openForAppend(), which cuts the file back to the last whole record, so later
+    // batches don't end up behind a torn one that replay stops at.
+    m_file.close();
+    return false;
+}
+
+bool MaskJournal::openForAppend(QSize maskSize)
+{
+    if (m_file.isOpen()) return true;
+    if (m_path.isEmpty() || !QDir().mkpath(QFileInfo(m_path).absolutePath())) return false;
+
+    m_file.setFileName(m_path);
+    if (m_file.open(QFile::ReadWrite)) {
+        // Continue a journal left over from a crash, minus any torn record at its end
+        qint64 validEnd = scanJournal(m_file, maskSize, nullptr, nullptr);
+        if (validEnd >= 0 && m_file.resize(validEnd) && m_file.seek(validEnd)) {
+            return true;
+        }
+        m_file.close();
+    }
+
+    // Missing, or written for a different mask: start over
+    if (!m_file.open(QFile::WriteOnly | QFile::Truncate)) return false;
+    QDataStream ds(&m_file);
+    ds << JournalMagic << quint32(maskSize.width()) << quint32(maskSize.height()) << quint32(MaskTileSize);
+    return ds.status() == QDataStream::Ok && syncToDisk(m_file);
+}
@@ -0,0 +1,53 @@
+#ifndef MASKJOURNAL_H
+#define MASKJOURNAL_H
+
+#include "defs.h"
+#include <QFile>
+#include <QImage>
+#include <QPoint>
+#include <QString>
+#include <QVector>
+
+// Append-only log of mask edits, kept next to the sidecar as "<image>.journal".
+// While editing, the alpha of changed MaskTileSize tiles is appended every few seconds,
+// so a crash loses at most that much work. Saving writes the full mask sidecar as
+// usual and discards the journal.
+//
+// Shape edits are logged the same way, as the whole shape list in the sidecar's JSON
+// form; the last such record wins.
+//
+// Layout: "CMJ1", width, height, tile size, then records of
+// (tile x, tile y, compressed length, qCompress'd alpha bytes). Shape records have
+// 0xffff for both tile coordinates and qCompress'd JSON as payload. A torn record at
+// the end is ignored on replay.
+class MaskJournal
+{
+public:
+    // Points the journal at another image. Nothing is created until the first append.
+    void setPath(const QString &path);
+    const QString &path() const { return m_path; }
+
+    // Applies every complete record on top of mask, which is first brought to
+    // imageSize like the canvas would, and shapes, which is replaced when any shape
+    // record was logged. Returns true if anything was applied.
+    bool replay(QImage &mask, QSize imageSize, QVector<MaskShape> &shapes) const;
+
+    // tiles are tile coordinates, mask is the canvas' ARGB32 premultiplied mask.
+    // On failure nothing of the batch is kept, the caller should try it again later.
+    bool append(const QImage &mask, const QVector<QPoint> &tiles);
+    // shapes is the whole list as it is now, for a mask of maskSize
+    bool appendShapes(QSize maskSize, const QVector<MaskShape> &shapes);
+
+    // Removes the journal, once its contents are in the regular sidecar
+    void discard();
+
+private:
+    bool openForAppend(QSize maskSize);
+    bool writeRecords(const QByteArray &records);
+
+private:
+    QString m_path;
+    QFile m_file;
+};
+
+#endif // MASKJOURNAL_H
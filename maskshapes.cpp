@@ -0,0 +1,261 @@
+#include "maskshapes.h"
+#include <QJsonObject>
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <utility>
+
+namespace MaskShapes {
+
+namespace {
+
+using CensorKernels::Span;
+
+// Far past any image, and far enough from INT_MAX that the int conversions in
+// scanConvert() and bounds(), and a chunk added to them, can't overflow
+constexpr double MaxCoordinate = std::numeric_limits<int>::max() / 4;
+
+struct Edge {
+    double top;
+    double bottom;
+    double xTop;
+    double dxdy;
+    int winding;
+};
+
+QVector<QPointF> outline(const MaskShape &shape)
+{
+    if (shape.type == MaskShape::Rect) {
+        if (shape.points.size() < 2) return {};
+        const QPointF a = shape.points[0];
+        const QPointF b = shape.points[1];
+        return { a, QPointF(b.x(), a.y()), b, QPointF(a.x(), b.y()) };
+    }
+    return shape.points.size() >= 3 ? shape.points : QVector<QPointF>();
+}
+
+// Exact pixel spans of one polygon for rows [rowBegin, rowEnd), in row order
+void scanConvert(const QVector<QPointF> &polygon, int width, int rowBegin, int rowEnd, std::vector<Span> &out)
+{
+    std::vector<Edge> edges;
+    double top = std::numeric_limits<double>::max();
+    double bottom = std::numeric_limits<double>::lowest();
+    for (int i = 0; i < polygon.size(); i++) {
+        const QPointF p = polygon[i];
+        const QPointF q = polygon[(i + 1) % polygon.size()];
+        top = std::min(top, p.y());
+        bottom = std::max(bottom, p.y());
+        if (p.y() == q.y()) continue; // Never crosses a row center by itself
+        const QPointF &upper = p.y() < q.y() ? p : q;
+        const QPointF &lower = p.y() < q.y() ? q : p;
+        edges.push_back({ upper.y(), lower.y(), upper.x(), (lower.x() - upper.x()) / (lower.y() - upper.y()),
+                          p.y() < q.y() ? 1 : -1 });
+    }
+    if (edges.empty()) return;
+
+    // Rows whose pixel centers y + 0.5 lie in [top, bottom)
+    const int yBegin = std::max(rowBegin, int(std::ceil(top - 0.5)));
+    const int yEnd = std::min(rowEnd, int(std::ceil(bottom - 0.5)));
+    std::vector<std::pair<double, int>> crossings;
+    for (int y = yBegin; y < yEnd; y++) {
+        const double center = y + 0.5;
+        crossings.clear();
+        for (const auto &e : edges) {
+            // Half-open, so a vertex on the center line is counted once
+            if (e.top <= center && center < e.bottom) {
+                crossings.emplace_back(e.xTop + (center - e.top) * e.dxdy, e.winding);
+            }
+        }
+        std::sort(crossings.begin(), crossings.end());
+
+        int winding = 0;
+        double start = 0;
+        for (const auto &crossing : crossings) {
+            const int before = winding;
+            winding += crossing.second;
+            if (before == 0 && winding != 0) {
+                start = crossing.first;
+            } else if (before != 0 && winding == 0) {
+                // Pixels whose center x + 0.5 lies in [start, end)
+                const int x0 = std::max(0, int(std::ceil(start - 0.5)));
+                const int x1 = std::min(width, int(std::ceil(crossing.first - 0.5)));
+                if (x1 > x0) {
+                    out.push_back({ y, x0, x1 });
+                }
+            }
+        }
+    }
+}
+
+// Grows spans of one shape to whole chunks. Every row of a chunk row gets the union
+// of the chunks any of its rows touches.
+std::vector<Span> snapToChunks(const std::vector<Span> &spans, QSize size, int chunkSize)
+{
+    std::vector<Span> snapped;
+    std::vector<std::pair<int, int>> chunks;
+    for (size_t first = 0; first < spans.size();) {
+        const int chunkY = spans[first].y / chunkSize * chunkSize;
+        const int chunkEnd = std::min(size.height(), chunkY + chunkSize);
+        chunks.clear();
+        size_t last = first;
+        for (; last < spans.size() && spans[last].y < chunkEnd; last++) {
+            chunks.emplace_back(spans[last].x0 / chunkSize, (spans[last].x1 - 1) / chunkSize);
+        }
+        std::sort(chunks.begin(), chunks.end());
+
+        std::vector<std::pair<int, int>> merged;
+        for (const auto &c : chunks) {
+            if (!merged.empty() && c.first <= merged.back().second + 1) {
+                merged.back().second = std::max(merged.back().second, c.second);
+            } else {
+                merged.push_back(c);
+            }
+        }
+        for (int y = chunkY; y < chunkEnd; y++) {
+            for (const auto &c : merged) {
+                snapped.push_back({ y, c.first * chunkSize, std::min(size.width(), (c.second + 1) * chunkSize) });
+            }
+        }
+        first = last;
+    }
+    return snapped;
+}
+
+} // namespace
+
+std::vector<Span> rasterize(const QVector<MaskShape> &shapes, QSize size, int chunkSize, const QRect &clip)
+{
+    const QRect area = clip.isNull() ? QRect(QPoint(0, 0), size) : clip & QRect(QPoint(0, 0), size);
+    std::vector<Span> spans;
+    if (area.isEmpty()) {
+        return spans;
+    }
+
+    for (const auto &shape : shapes) {
+        const auto polygon = outline(shape);
+        if (polygon.isEmpty()) continue;
+
+        std::vector<Span> shapeSpans;
+        if (shape.snapToChunks && chunkSize > 1) {
+            // Whole chunk rows, any of their rows can widen the others
+            const int rowBegin = area.top() / chunkSize * chunkSize;
+            const int rowEnd = std::min(size.height(), (area.bottom() / chunkSize + 1) * chunkSize);
+            scanConvert(polygon, size.width(), rowBegin, rowEnd, shapeSpans);
+            shapeSpans = snapToChunks(shapeSpans, size, chunkSize);
+        } else {
+            scanConvert(polygon, size.width(), area.top(), area.bottom() + 1, shapeSpans);
+        }
+
+        for (const auto &span : shapeSpans) {
+            const int x0 = std::max(span.x0, area.left());
+            const int x1 = std::min(span.x1, area.right() + 1);
+            if (span.y >= area.top() && span.y <= area.bottom() && x1 > x0) {
+                spans.push_back({ span.y, x0, x1 });
+            }
+        }
+    }
+
+    // Overlapping shapes are filled once
+    std::sort(spans.begin(), spans.end(), [](const Span &a, const Span &b) {
+        return a.y != b.y ? a.y < b.y : a.x0 < b.x0;
+    });
+    std::vector<Span> merged;
+    for (const auto &span : spans) {
+        if (!merged.empty() && merged.back().y == span.y && span.x0 <= merged.back().x1) {
+            merged.back().x1 = std::max(merged.back().x1, span.x1);
+        } else {
+            merged.push_back(span);
+        }
+    }
+    return merged;
+}
+
+QRect bounds(const MaskShape &shape, QSize size, int chunkSize)
+{
+    const auto polygon = outline(shape);
+    if (polygon.isEmpty()) {
+        return QRect();
+    }
+    double left = polygon[0].x(), right = left, top = polygon[0].y(), bottom = top;
+    for (const auto &p : polygon) {
+        left = std::min(left, p.x());
+        right = std::max(right, p.x());
+        top = std::min(top, p.y());
+        bottom = std::max(bottom, p.y());
+    }
+    QRect rect(QPoint(int(std::floor(left)), int(std::floor(top))), QPoint(int(std::ceil(right)), int(std::ceil(bottom))));
+    if (shape.snapToChunks && chunkSize > 1) {
+        rect.setLeft(std::max(0, rect.left()) / chunkSize * chunkSize);
+        rect.setTop(std::max(0, rect.top()) / chunkSize * chunkSize);
+        rect.setRight((std::max(0, rect.right()) / chunkSize + 1) * chunkSize - 1);
+        rect.setBottom((std::max(0, rect.bottom()) / chunkSize + 1) * chunkSize - 1);
+    }
+    return rect & QRect(QPoint(0, 0), size);
+}
+
+void fill(QImage &mask, const QVector<MaskShape> &shapes, int chunkSize, const QRect &clip)
+{
+    CensorKernels::fillSpans(mask, 0xffffffff, rasterize(shapes, mask.size(), chunkSize, clip));
+}
+
+int shapeAt(const QVector<MaskShape> &shapes, QPoint pos, QSize size, int chunkSize)
+{
+    for (int i = shapes.size() - 1; i >= 0; i--) {
+        for (const auto &span : rasterize({ shapes[i] }, size, chunkSize, QRect(pos, QSize(1, 1)))) {
+            if (span.x0 <= pos.x() && pos.x() < span.x1) {
+                return i;
+            }
+        }
+    }
+    return -1;
+}
+
+bool anySnapped(const QVector<MaskShape> &shapes)
+{
+    return std::any_of(shapes.begin(), shapes.end(), [](const MaskShape &shape) { return shape.snapToChunks; });
+}
+
+QJsonArray toJson(const QVector<MaskShape> &shapes)
+{
+    QJsonArray array;
+    for (const auto &shape : shapes) {
+        QJsonObject obj;
+        obj["type"] = shape.type == MaskShape::Rect ? "rect" : "polygon";
+        QJsonArray points;
+        for (const auto &p : shape.points) {
+            points.append(p.x());
+            points.append(p.y());
+        }
+        obj["points"] = points;
+        if (shape.snapToChunks) {
+            obj["snap"] = true;
+        }
+        array.append(obj);
+    }
+    return array;
+}
+
+QVector<MaskShape> fromJson(const QJsonArray &array)
+{
+    QVector<MaskShape> shapes;
+    for (const auto &value : array) {
+        auto obj = value.toObject();
+        MaskShape shape;
+        shape.type = obj["type"].toString() == "polygon" ? MaskShape::Polygon : MaskShape::Rect;
+        auto points = obj["points"].toArray();
+        for (int i = 0; i + 1 < points.size(); i += 2) {
+            const double x = points[i].toDouble();
+            const double y = points[i + 1].toDouble();
+            if (!std::isfinite(x) || !std::isfinite(y)) continue;
+            shape.points.append(QPointF(std::clamp(x, -MaxCoordinate, MaxCoordinate),
+                                        std::clamp(y, -MaxCoordinate, MaxCoordinate)));
+        }
+        shape.snapToChunks = obj["snap"].toBool(false);
+        if (shape.points.size() >= (shape.type == MaskShape::Rect ? 2 : 3)) {
+            shapes.append(shape);
+        }
+    }
+    return shapes;
+}
+
+} // namespace MaskShapes
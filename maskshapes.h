@@ -0,0 +1,44 @@
+#ifndef MASKSHAPES_H
+#define MASKSHAPES_H
+
+#include "defs.h"
+#include "censorkernels.h"
+#include <QImage>
+#include <QJsonArray>
+#include <QRect>
+#include <QVector>
+#include <vector>
+
+// Rectangles and polygons censored on top of the brushed mask. They are kept as
+// vectors in the sidecar JSON and turned into spans of pixels by a scanline fill
+// wherever they're used, so snapped shapes follow the chunk grid as chunk size changes.
+namespace MaskShapes {
+
+// A pixel is inside when its center is, by the nonzero winding rule. Snapped shapes
+// cover every chunkSize chunk (gridded from 0,0 like pixelize()) they cover a pixel of.
+// Spans of all shapes are merged, sorted by row then x, and clipped to size and, unless
+// it is null, to clip.
+std::vector<CensorKernels::Span> rasterize(const QVector<MaskShape> &shapes, QSize size, int chunkSize,
+                                           const QRect &clip = QRect());
+
+// Pixels rasterize() may cover for shape, e.g. to repaint
+QRect bounds(const MaskShape &shape, QSize size, int chunkSize);
+
+// Makes the shapes' pixels inside clip (all when null) opaque white.
+// mask is Format_ARGB32_Premultiplied.
+void fill(QImage &mask, const QVector<MaskShape> &shapes, int chunkSize, const QRect &clip = QRect());
+
+// Index of the topmost shape covering pos, -1 for none
+int shapeAt(const QVector<MaskShape> &shapes, QPoint pos, QSize size, int chunkSize);
+
+bool anySnapped(const QVector<MaskShape> &shapes);
+
+// [{ "type": "rect" | "polygon", "points": [x0, y0, x1, y1, ...], "snap": true }, ...]
+QJsonArray toJson(const QVector<MaskShape> &shapes);
+// Points that aren't finite are dropped, the rest clamped to a quarter of the int range
+// either way; shapes left with too few points are dropped
+QVector<MaskShape> fromJson(const QJsonArray &array);
+
+} // namespace MaskShapes
+
+#endif // MASKSHAPES_H
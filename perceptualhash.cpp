@@ -0,0 +1,143 @@
+#include "perceptualhash.h"
+#include "censorkernels.h"
+#include "censorrender.h"
+#include "defs.h"
+#include <QDateTime>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QImageReader>
+#include <QJsonDocument>
+#include <QSaveFile>
+
+namespace PerceptualHash {
+
+quint64 dHash(const QImage &image)
+{
+    if (image.isNull()) {
+        return 0;
+    }
+    // Area averaging rather than sampling, so noise and JPEG artifacts don't flip bits
+    QImage thumbnail(9, 8, QImage::Format_ARGB32_Premultiplied);
+    CensorKernels::downscaleArea(image.convertToFormat(QImage::Format_ARGB32_Premultiplied), thumbnail);
+
+    quint64 hash = 0;
+    for (int y = 0; y < 8; y++) {
+        auto line = reinterpret_cast<const QRgb*>(thumbnail.constScanLine(y));
+        int previous = qGray(line[0]);
+        for (int x = 1; x < 9; x++) {
+            const int gray = qGray(line[x]);
+            hash = (hash << 1) | (previous > gray ? 1 : 0);
+            previous = gray;
+        }
+    }
+    return hash;
+}
+
+bool hashFile(const QString &absPath, quint64 &hash, QSize &size)
+{
+    QImageReader reader(absPath);
+    size = reader.size();
+    if (!size.isValid()) {
+        return false;
+    }
+    // JPEG decodes straight at a fraction of the size; still plenty of pixels per cell
+    if (size.width() > 144 && size.height() > 128) {
+        reader.setScaledSize(size.scaled(144, 128, Qt::KeepAspectRatioByExpanding));
+    }
+    QImage image = reader.read();
+    if (image.isNull()) {
+        return false;
+    }
+    hash = dHash(image);
+    return true;
+}
+
+} // namespace PerceptualHash
+
+void PerceptualHashIndex::setFolder(const QString &folder)
+{
+    m_folder = folder;
+    m_entries = QJsonObject();
+    m_dirty = false;
+}
+
+bool PerceptualHashIndex::load()
+{
+    QFile f(m_folder + QDir::separator() + CensorMeDataDir + QDir::separator() + FileName);
+    if (!f.open(QFile::ReadOnly)) return false;
+    QJsonParseError pe;
+    auto jsd = QJsonDocument::fromJson(f.readAll(), &pe);
+    if (pe.error != QJsonParseError::NoError || !jsd.isObject()) return false;
+    m_entries = jsd.object()["files"].toObject();
+    return true;
+}
+
+bool PerceptualHashIndex::save()
+{
+    if (!m_dirty) return true;
+
+    QDir dataDir(m_folder + QDir::separator() + CensorMeDataDir);
+    if (!dataDir.exists() && !QDir().mkpath(dataDir.absolutePath())) return false;
+
+    QJsonObject ro;
+    ro["version"] = 1;
+    ro["files"] = m_entries;
+    QSaveFile f(dataDir.absoluteFilePath(FileName));
+    if (!f.open(QFile::WriteOnly)) return false;
+    f.write(QJsonDocument(ro).toJson(QJsonDocument::Compact));
+    if (!f.commit()) return false;
+    m_dirty = false;
+    return true;
+}
+
+bool PerceptualHashIndex::lookup(const QString &fileName, quint64 &hash, QSize &size) const
+{
+    auto entry = m_entries[fileName].toObject();
+    if (entry.isEmpty()) {
+        return false;
+    }
+    QFileInfo fi(m_folder + QDir::separator() + fileName);
+    if (entry["size"].toDouble() != double(fi.size()) ||
+        entry["mtime"].toDouble() != double(fi.lastModified().toMSecsSinceEpoch())) {
+        return false;
+    }
+    hash = entry["hash"].toString().toULongLong(nullptr, 16);
+    size = QSize(entry["width"].toInt(), entry["height"].toInt());
+    return true;
+}
+
+void PerceptualHashIndex::insert(const QString &fileName, quint64 hash, QSize size)
+{
+    QFileInfo fi(m_folder + QDir::separator() + fileName);
+    QJsonObject entry;
+    // Hex, JSON numbers are doubles and would lose bits
+    entry["hash"] = QString::number(hash, 16);
+    entry["width"] = size.width();
+    entry["height"] = size.height();
+    entry["size"] = double(fi.size());
+    entry["mtime"] = double(fi.lastModified().toMSecsSinceEpoch());
+    m_entries[fileName] = entry;
+    m_dirty = true;
+}
+
+QString PerceptualHashIndex::findMaskedMatch(const QString &fileName, quint64 hash, QSize size) const
+{
+    QString best;
+    int bestDistance = PerceptualHash::MaxSimilarDistance + 1;
+    for (auto it = m_entries.begin(); it != m_entries.end(); ++it) {
+        if (it.key() == fileName) continue;
+        auto entry = it.value().toObject();
+        // Masks are in pixels, they only carry over between images of the same size
+        if (QSize(entry["width"].toInt(), entry["height"].toInt()) != size) continue;
+        const int d = PerceptualHash::distance(hash, entry["hash"].toString().toULongLong(nullptr, 16));
+        if (d >= bestDistance) continue;
+
+        auto path = m_folder + QDir::separator() + it.key();
+        if (QFileInfo::exists(CensorRender::sidecarBasePath(path) + ".png")) {
+            best = path;
+            bestDistance = d;
+        }
+    }
+    return best;
+}
@@ -0,0 +1,57 @@
+#ifndef PERCEPTUALHASH_H
+#define PERCEPTUALHASH_H
+
+#include <QImage>
+#include <QJsonObject>
+#include <QSize>
+#include <QString>
+#include <bitset>
+
+// Difference hashes: 64 bits of "is this cell brighter than its right neighbour" over
+// a 9x8 area-averaged grayscale thumbnail. Frames of the same burst land a few bits
+// apart; unrelated images around 32.
+namespace PerceptualHash {
+
+// Hashes closer than this are the same scene, masks carry over between them
+constexpr int MaxSimilarDistance = 8;
+
+quint64 dHash(const QImage &image);
+
+// Decodes only as much as the hash needs. size is the full image size.
+bool hashFile(const QString &absPath, quint64 &hash, QSize &size);
+
+inline int distance(quint64 a, quint64 b)
+{
+    return int(std::bitset<64>(a ^ b).count());
+}
+
+} // namespace PerceptualHash
+
+// Hashes of the images in one folder, kept in a hidden file in its CensorMeData so
+// the folder is only ever hashed once. Entries go stale when the image's size or
+// mtime changes.
+class PerceptualHashIndex
+{
+public:
+    static constexpr const char* FileName = ".perceptualhashes.json";
+
+    void setFolder(const QString &folder);
+    QString folder() const { return m_folder; }
+
+    bool load();
+    bool save();
+
+    bool lookup(const QString &fileName, quint64 &hash, QSize &size) const;
+    void insert(const QString &fileName, quint64 hash, QSize size);
+
+    // The most similar other image of the same size that has a saved mask, if any is
+    // within MaxSimilarDistance
+    QString findMaskedMatch(const QString &fileName, quint64 hash, QSize size) const;
+
+private:
+    QString m_folder;
+    QJsonObject m_entries;
+    bool m_dirty = false;
+};
+
+#endif // PERCEPTUALHASH_H
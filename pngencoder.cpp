@@ -0,0 +1,394 @@
+#include "pngencoder.h"
+#include <QFileInfo>
+#include <QtEndian>
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <zlib.h>
+
+namespace PngEncoder {
+
+namespace {
+
+enum ColorType {
+    Gray = 0,
+    RGB = 2,
+    GrayAlpha = 4,
+    RGBA = 6
+};
+
+enum Filter {
+    None,
+    Sub,
+    Up,
+    Average,
+    Paeth,
+    FilterCount
+};
+
+constexpr int WindowBytes = 32768;
+// Big enough that the sync flush and the cut cost next to nothing, small enough that a
+// 50 MP mask still gives every core a few dozen blocks
+constexpr int BlockBytes = 512 * 1024;
+
+int bytesPerPixel(ColorType type)
+{
+    switch (type) {
+    case Gray: return 1;
+    case GrayAlpha: return 2;
+    case RGB: return 3;
+    default: return 4;
+    }
+}
+
+// Runs work(0 .. count - 1) on the scheduler's workers and the calling thread. Blocks are
+// claimed one at a time and the caller claims too, so it never waits on helpers that
+// haven't started, e.g. because every worker is busy with the task that called this.
+void forEachBlock(int count, TaskScheduler::Priority priority, const std::function<void(int)> &work)
+{
+    struct State {
+        std::atomic<int> next{ 0 };
+        std::mutex mutex;
+        std::condition_variable finished;
+        int done = 0;
+    };
+    auto state = std::make_shared<State>();
+    // A helper that starts late claims nothing and never touches work, which is gone by then
+    const auto *workPtr = &work;
+    auto run = [state, count, workPtr]() {
+        for (int i; (i = state->next++) < count;) {
+            (*workPtr)(i);
+            std::lock_guard<std::mutex> lock(state->mutex);
+            if (++state->done == count) {
+                state->finished.notify_all();
+            }
+        }
+    };
+
+    auto &scheduler = TaskScheduler::instance();
+    const int helpers = std::min(count, scheduler.threadCount()) - 1;
+    for (int i = 0; i < helpers; i++) {
+        scheduler.submit(priority, run);
+    }
+    run();
+    std::unique_lock<std::mutex> lock(state->mutex);
+    state->finished.wait(lock, [&] { return state->done == count; });
+}
+
+// One row as PNG samples, straight (not premultiplied) alpha
+void convertRow(const QImage &image, int y, ColorType type, uchar *out)
+{
+    auto line = reinterpret_cast<const QRgb*>(image.constScanLine(y));
+    const bool premultiplied = image.format() == QImage::Format_ARGB32_Premultiplied;
+    for (int x = 0; x < image.width(); x++) {
+        QRgb p = line[x];
+        if (premultiplied) {
+            p = qUnpremultiply(p);
+        }
+        switch (type) {
+        case Gray:
+            *out++ = uchar(qRed(p));
+            break;
+        case GrayAlpha:
+            *out++ = uchar(qRed(p));
+            *out++ = uchar(qAlpha(p));
+            break;
+        case RGB:
+            *out++ = uchar(qRed(p));
+            *out++ = uchar(qGreen(p));
+            *out++ = uchar(qBlue(p));
+            break;
+        case RGBA:
+            *out++ = uchar(qRed(p));
+            *out++ = uchar(qGreen(p));
+            *out++ = uchar(qBlue(p));
+            *out++ = uchar(qAlpha(p));
+            break;
+        }
+    }
+}
+
+// Residuals as signed bytes, summed; lower usually deflates smaller. Stops once past
+// limit, the filter has lost by then.
+inline quint64 residual(uchar v)
+{
+    return v < 128 ? v : 256 - v;
+}
+
+template<typename Predict>
+quint64 applyFilter(const uchar *row, const uchar *prior, int length, int bpp, uchar *out, quint64 limit,
+                    Predict predict)
+{
+    quint64 sum = 0;
+    for (int i = 0; i < bpp; i++) {
+        out[i] = uchar(row[i] - predict(0, prior[i], 0));
+        sum += residual(out[i]);
+    }
+    for (int i = bpp; i < length; i++) {
+        out[i] = uchar(row[i] - predict(row[i - bpp], prior[i], prior[i - bpp]));
+        sum += residual(out[i]);
+        if ((i & 1023) == 0 && sum >= limit) {
+            return sum;
+        }
+    }
+    return sum;
+}
+
+quint64 applyFilter(Filter filter, const uchar *row, const uchar *prior, int length, int bpp, uchar *out,
+                    quint64 limit)
+{
+    switch (filter) {
+    case None:
+        return applyFilter(row, prior, length, bpp, out, limit, [](int, int, int) { return 0; });
+    case Sub:
+        return applyFilter(row, prior, length, bpp, out, limit, [](int a, int, int) { return a; });
+    case Up:
+        return applyFilter(row, prior, length, bpp, out, limit, [](int, int b, int) { return b; });
+    case Average:
+        return applyFilter(row, prior, length, bpp, out, limit, [](int a, int b, int) { return (a + b) >> 1; });
+    default:
+        return applyFilter(row, prior, length, bpp, out, limit, [](int a, int b, int c) {
+            const int p = a + b - c;
+            const int pa = std::abs(p - a);
+            const int pb = std::abs(p - b);
+            const int pc = std::abs(p - c);
+            return pa <= pb && pa <= pc ? a : pb <= pc ? b : c;
+        });
+    }
+}
+
+// Writes the filter byte and the filtered row to out. Masks are mostly rows that are
+// empty or repeat the one above, those are settled without trying every filter.
+void filterRow(const uchar *row, const uchar *prior, int length, int bpp, uchar *out,
+               std::vector<uchar> &scratch)
+{
+    if (std::all_of(row, row + length, [](uchar v) { return v == 0; })) {
+        out[0] = None;
+        std::memset(out + 1, 0, size_t(length));
+        return;
+    }
+    if (std::memcmp(row, prior, size_t(length)) == 0) {
+        out[0] = Up;
+        std::memset(out + 1, 0, size_t(length));
+        return;
+    }
+
+    // Otherwise the usual minimum sum of absolute differences. Up goes first: on a mask
+    // only the few pixels where an edge moved are left, and the rest rarely get close.
+    scratch.resize(size_t(length));
+    out[0] = Up;
+    quint64 bestCost = applyFilter(Up, row, prior, length, bpp, out + 1, ~quint64(0));
+    for (Filter f : { Sub, None, Paeth, Average }) {
+        const quint64 cost = applyFilter(f, row, prior, length, bpp, scratch.data(), bestCost);
+        if (cost < bestCost) {
+            bestCost = cost;
+            out[0] = uchar(f);
+            std::memcpy(out + 1, scratch.data(), size_t(length));
+        }
+    }
+}
+
+struct Block {
+    QByteArray deflated;
+    uLong adler = 1;
+    uLong length = 0; // Filtered bytes in, for adler32_combine()
+    uLong crc = 0;    // Of the IDAT chunk holding deflated
+    bool ok = false;
+};
+
+uLong chunkCrc(const char *type, const QByteArray &data)
+{
+    uLong crc = crc32(0, reinterpret_cast<const Bytef*>(type), 4);
+    return crc32(crc, reinterpret_cast<const Bytef*>(data.constData()), uInt(data.size()));
+}
+
+// Filters rows [first, last) and deflates them as a raw stream, primed with the filtered
+// rows before first. Every row filters to the same bytes whichever block does it, so the
+// dictionary is exactly what the decoder has in its window at this point.
+void deflateRows(const QImage &image, ColorType type, int first, int last, bool final, int level,
+                 const QByteArray &streamHeader, Block &block)
+{
+    const int bpp = bytesPerPixel(type);
+    const int rowBytes = image.width() * bpp;
+    const int stride = rowBytes + 1;
+    const int dictRows = std::min(first, (WindowBytes + stride - 1) / stride);
+    const int start = first - dictRows;
+
+    std::vector<uchar> prior(size_t(rowBytes), 0), row(prior.size()), scratch;
+    if (start > 0) {
+        convertRow(image, start - 1, type, prior.data());
+    }
+    std::vector<uchar> filtered(size_t(stride) * size_t(last - start));
+    for (int y = start; y < last; y++) {
+        convertRow(image, y, type, row.data());
+        filterRow(row.data(), prior.data(), rowBytes, bpp, filtered.data() + size_t(stride) * size_t(y - start), scratch);
+        std::swap(row, prior);
+    }
+
+    const size_t dictBytes = std::min(size_t(WindowBytes), size_t(stride) * size_t(dictRows));
+    const uchar *input = filtered.data() + size_t(stride) * size_t(dictRows);
+    block.length = uLong(stride) * uLong(last - first);
+    block.adler = adler32(1, input, uInt(block.length));
+
+    z_stream zs = {};
+    // Filtered image data has few long repeats, zlib's filtered strategy is tuned for it
+    if (deflateInit2(&zs, level, Z_DEFLATED, -MAX_WBITS, 8, Z_FILTERED) != Z_OK) {
+        return;
+    }
+    if (dictBytes > 0) {
+        deflateSetDictionary(&zs, input - dictBytes, uInt(dictBytes));
+    }
+    zs.next_in = const_cast<Bytef*>(input);
+    zs.avail_in = uInt(block.length);
+
+    // Byte aligned end without a final block, so the next block's stream can follow
+    const int flush = final ? Z_FINISH : Z_SYNC_FLUSH;
+    block.deflated = streamHeader;
+    int produced = block.deflated.size();
+    block.deflated.resize(produced + int(deflateBound(&zs, block.length)) + 16);
+    for (;;) {
+        zs.next_out = reinterpret_cast<Bytef*>(block.deflated.data()) + produced;
+        zs.avail_out = uInt(block.deflated.size() - produced);
+        const int ret = deflate(&zs, flush);
+        produced = block.deflated.size() - int(zs.avail_out);
+        if (ret == Z_STREAM_ERROR) {
+            deflateEnd(&zs);
+            return;
+        }
+        if (zs.avail_out > 0 && (!final || ret == Z_STREAM_END)) {
+            break;
+        }
+        block.deflated.resize(block.deflated.size() * 2);
+    }
+    deflateEnd(&zs);
+    block.deflated.resize(produced);
+    block.crc = chunkCrc("IDAT", block.deflated);
+    block.ok = true;
+}
+
+QByteArray bigEndian32(quint32 value)
+{
+    QByteArray bytes(4, Qt::Uninitialized);
+    qToBigEndian<quint32>(value, bytes.data());
+    return bytes;
+}
+
+void appendChunk(QByteArray &png, const char *type, const QByteArray &data, uLong crc)
+{
+    png.append(bigEndian32(quint32(data.size())));
+    png.append(type, 4);
+    png.append(data);
+    png.append(bigEndian32(quint32(crc)));
+}
+
+void appendChunk(QByteArray &png, const char *type, const QByteArray &data)
+{
+    appendChunk(png, type, data, chunkCrc(type, data));
+}
+
+} // namespace
+
+QByteArray encode(const QImage &source, TaskScheduler::Priority priority, int level)
+{
+    if (source.isNull()) {
+        return QByteArray();
+    }
+    QImage image = source;
+    if (image.format() != QImage::Format_RGB32 && image.format() != QImage::Format_ARGB32 &&
+        image.format() != QImage::Format_ARGB32_Premultiplied) {
+        image = image.convertToFormat(image.hasAlphaChannel() ? QImage::Format_ARGB32 : QImage::Format_RGB32);
+    }
+
+    const int width = image.width();
+    const int height = image.height();
+    const int stride = width * 4 + 1;
+    const int rowsPerBlock = std::max(1, BlockBytes / stride);
+    const int blockCount = (height + rowsPerBlock - 1) / rowsPerBlock;
+
+    // Colour type first: is every pixel gray, is every pixel opaque. Both survive
+    // unpremultiplying, which maps equal channels to equal channels.
+    std::vector<uchar> notGray(size_t(blockCount), 0), notOpaque(size_t(blockCount), 0);
+    const bool opaqueFormat = image.format() == QImage::Format_RGB32;
+    forEachBlock(blockCount, priority, [&](int b) {
+        const int last = std::min(height, (b + 1) * rowsPerBlock);
+        for (int y = b * rowsPerBlock; y < last && !(notGray[b] && notOpaque[b]); y++) {
+            auto line = reinterpret_cast<const QRgb*>(image.constScanLine(y));
+            for (int x = 0; x < width; x++) {
+                const QRgb p = line[x];
+                notGray[b] |= qRed(p) != qGreen(p) || qGreen(p) != qBlue(p);
+                notOpaque[b] |= !opaqueFormat && qAlpha(p) != 255;
+            }
+        }
+    });
+    const bool gray = std::none_of(notGray.begin(), notGray.end(), [](uchar v) { return v; });
+    const bool opaque = std::none_of(notOpaque.begin(), notOpaque.end(), [](uchar v) { return v; });
+    const ColorType type = gray ? (opaque ? Gray : GrayAlpha) : (opaque ? RGB : RGBA);
+
+    // One zlib stream over all blocks: its header goes in front of the first block's raw
+    // stream, the combined adler after the last
+    const int effectiveLevel = level < 0 ? 6 : level;
+    const int levelFlag = effectiveLevel < 2 ? 0 : effectiveLevel < 6 ? 1 : effectiveLevel == 6 ? 2 : 3;
+    const int check = (0x78 << 8) | (levelFlag << 6);
+    QByteArray streamHeader;
+    streamHeader.append(char(0x78));
+    streamHeader.append(char((levelFlag << 6) + (31 - check % 31) % 31));
+
+    // Cut by the same row count as the scan, which keeps each under BlockBytes of RGBA
+    std::vector<Block> blocks(blockCount);
+    forEachBlock(blockCount, priority, [&](int b) {
+        const int last = std::min(height, (b + 1) * rowsPerBlock);
+        deflateRows(image, type, b * rowsPerBlock, last, b == blockCount - 1, level,
+                    b == 0 ? streamHeader : QByteArray(), blocks[b]);
+    });
+    uLong adler = 1;
+    for (const auto &block : blocks) {
+        if (!block.ok) {
+            return QByteArray();
+        }
+        adler = adler32_combine(adler, block.adler, block.length);
+    }
+
+    QByteArray png("\x89PNG\r\n\x1a\n", 8);
+
+    QByteArray header = bigEndian32(quint32(width)) + bigEndian32(quint32(height));
+    header.append(char(8));    // Bit depth
+    header.append(char(type));
+    header.append(char(0));    // Deflate
+    header.append(char(0));    // Adaptive filtering
+    header.append(char(0));    // Not interlaced
+    appendChunk(png, "IHDR", header);
+
+    if (image.dotsPerMeterX() > 0 && image.dotsPerMeterY() > 0) {
+        QByteArray physical = bigEndian32(quint32(image.dotsPerMeterX())) + bigEndian32(quint32(image.dotsPerMeterY()));
+        physical.append(char(1)); // Metres
+        appendChunk(png, "pHYs", physical);
+    }
+
+    // Every block in its own IDAT, how the stream is chunked doesn't matter to decoders
+    for (int b = 0; b < blockCount; b++) {
+        Block &block = blocks[b];
+        if (b == blockCount - 1) {
+            const auto trailer = bigEndian32(quint32(adler));
+            block.deflated.append(trailer);
+            block.crc = crc32_combine(block.crc, crc32(0, reinterpret_cast<const Bytef*>(trailer.constData()), 4), 4);
+        }
+        appendChunk(png, "IDAT", block.deflated, block.crc);
+        block.deflated = QByteArray();
+    }
+
+    appendChunk(png, "IEND", QByteArray());
+    return png;
+}
+
+bool isPngFileName(const QString &fileName)
+{
+    return QFileInfo(fileName).suffix().compare("png", Qt::CaseInsensitive) == 0;
+}
+
+} // namespace PngEncoder
@@ -0,0 +1,25 @@
+#ifndef PNGENCODER_H
+#define PNGENCODER_H
+
+#include "taskscheduler.h"
+#include <QByteArray>
+#include <QImage>
+#include <QString>
+
+// PNG writer that deflates on every core, the way pigz does: the image is cut into
+// blocks of rows, each block is deflated on its own, primed with the 32 KiB of filtered
+// data before it so no match across the cut is lost, and the raw deflate streams are
+// joined into one zlib stream with adler32_combine().
+namespace PngEncoder {
+
+// Writes 8 bit samples in the smallest colour type that holds image exactly, so a
+// white-on-transparent mask becomes gray + alpha and an opaque frame RGB. priority is
+// that of the helper tasks; the calling thread works on blocks too, so this is safe to
+// call from a task. Returns an empty array on failure.
+QByteArray encode(const QImage &image, TaskScheduler::Priority priority, int level = 6);
+
+bool isPngFileName(const QString &fileName);
+
+} // namespace PngEncoder
+
+#endif // PNGENCODER_H
@@ -0,0 +1,99 @@
+#include "tarwriter.h"
+#include <cstdio>
+#include <cstring>
+
+namespace {
+
+constexpr int BlockSize = 512;
+
+// Field offsets and sizes of the ustar header
+struct Field {
+    int offset;
+    int size;
+};
+constexpr Field NameField = { 0, 100 };
+constexpr Field ModeField = { 100, 8 };
+constexpr Field UidField = { 108, 8 };
+constexpr Field GidField = { 116, 8 };
+constexpr Field SizeField = { 124, 12 };
+constexpr Field MtimeField = { 136, 12 };
+constexpr Field ChecksumField = { 148, 8 };
+constexpr int TypeFlagOffset = 156;
+constexpr Field MagicField = { 257, 8 }; // "ustar\0" and version "00"
+constexpr Field PrefixField = { 345, 155 };
+
+// Zero-padded octal with a terminating NUL, as wide as the field allows
+void putOctal(char *header, Field field, quint64 value)
+{
+    std::snprintf(header + field.offset, size_t(field.size), "%0*llo", field.size - 1, (unsigned long long)value);
+}
+
+} // namespace
+
+TarWriter::TarWriter(QIODevice *device)
+    : m_device(device)
+{
+}
+
+bool TarWriter::addFile(const QString &name, const QByteArray &data, const QDateTime &modified)
+{
+    // Longer names go in the prefix field, split at a '/'
+    const QByteArray path = name.toUtf8();
+    QByteArray prefix, tail = path;
+    if (path.size() > NameField.size) {
+        int split = path.lastIndexOf('/', PrefixField.size);
+        if (split <= 0 || path.size() - split - 1 > NameField.size) {
+            m_error = QString("File name too long for a tar archive: %1").arg(name);
+            return false;
+        }
+        prefix = path.left(split);
+        tail = path.mid(split + 1);
+    }
+    if (quint64(data.size()) >= (quint64(1) << 33)) {
+        m_error = QString("File too large for a tar archive: %1").arg(name);
+        return false;
+    }
+
+    char header[BlockSize];
+    std::memset(header, 0, sizeof(header));
+    std::memcpy(header + NameField.offset, tail.constData(), size_t(tail.size()));
+    std::memcpy(header + PrefixField.offset, prefix.constData(), size_t(prefix.size()));
+    putOctal(header, ModeField, 0644);
+    putOctal(header, UidField, 0);
+    putOctal(header, GidField, 0);
+    putOctal(header, SizeField, quint64(data.size()));
+    putOctal(header, MtimeField, quint64(qMax<qint64>(0, modified.toSecsSinceEpoch())));
+    header[TypeFlagOffset] = '0';
+    std::memcpy(header + MagicField.offset, "ustar\0" "00", 8);
+
+    // Checksum is taken with its own field filled with spaces
+    std::memset(header + ChecksumField.offset, ' ', size_t(ChecksumField.size));
+    unsigned checksum = 0;
+    for (unsigned char c : header) checksum += c;
+    std::snprintf(header + ChecksumField.offset, 7, "%06o", checksum);
+
+    if (!write(header, BlockSize) || !write(data.constData(), data.size())) {
+        return false;
+    }
+    static const char zeros[BlockSize] = {};
+    const int padding = (BlockSize - data.size() % BlockSize) % BlockSize;
+    return write(zeros, padding);
+}
+
+bool TarWriter::finish()
+{
+    static const char zeros[BlockSize * 2] = {};
+    return write(zeros, sizeof(zeros));
+}
+
+bool TarWriter::write(const char *data, qint64 size)
+{
+    if (size == 0) {
+        return true;
+    }
+    if (m_device->write(data, size) != size) {
+        m_error = m_device->errorString();
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,35 @@
+#ifndef TARWRITER_H
+#define TARWRITER_H
+
+#include <QByteArray>
+#include <QDateTime>
+#include <QIODevice>
+#include <QString>
+
+// Streams regular files into a POSIX ustar archive on any sequential device. Each
+// file is one header block plus its data padded to 512 bytes, so an archive is
+// written front to back without ever seeking.
+class TarWriter
+{
+public:
+    explicit TarWriter(QIODevice *device);
+
+    // name is relative and '/'-separated; at most 255 bytes of UTF-8 with no
+    // component over 100. Files must be under 8 GiB.
+    bool addFile(const QString &name, const QByteArray &data,
+                 const QDateTime &modified = QDateTime::currentDateTimeUtc());
+
+    // Writes the end-of-archive marker. The device is left open.
+    bool finish();
+
+    QString errorString() const { return m_error; }
+
+private:
+    bool write(const char *data, qint64 size);
+
+private:
+    QIODevice *m_device;
+    QString m_error;
+};
+
+#endif // TARWRITER_H
@@ -0,0 +1,225 @@
+#include "taskscheduler.h"
+#include <QThread>
+#include <algorithm>
+#if defined(Q_OS_LINUX)
+#include <pthread.h>
+#include <sched.h>
+#elif defined(Q_OS_WIN)
+#define NOMINMAX
+#include <windows.h>
+#endif
+
+namespace {
+
+struct Config {
+    int threads = 0;
+    bool pinThreads = false;
+};
+Config g_config;
+
+// Which worker of which scheduler the current thread is, if any
+thread_local const TaskScheduler *t_scheduler = nullptr;
+thread_local int t_workerIndex = -1;
+
+void pinToCore(int index)
+{
+    const int cores = std::max(1, QThread::idealThreadCount());
+#if defined(Q_OS_LINUX)
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(index % cores, &set);
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+#elif defined(Q_OS_WIN)
+    SetThreadAffinityMask(GetCurrentThread(), DWORD_PTR(1) << (index % std::min(cores, 64)));
+#else
+    Q_UNUSED(index)
+    Q_UNUSED(cores)
+#endif
+}
+
+} // namespace
+
+void TaskScheduler::TaskGroup::wait()
+{
+    std::unique_lock<std::mutex> lock(m_state->mutex);
+    m_state->done.wait(lock, [this] { return m_state->pending == 0; });
+}
+
+TaskScheduler &TaskScheduler::instance()
+{
+    static TaskScheduler scheduler([] {
+        int threads = g_config.threads > 0 ? g_config.threads : qEnvironmentVariableIntValue("CENSORME_THREADS");
+        return threads > 0 ? threads : std::max(1, QThread::idealThreadCount());
+    }(), g_config.pinThreads || qEnvironmentVariableIntValue("CENSORME_PIN_THREADS") != 0);
+    return scheduler;
+}
+
+void TaskScheduler::configure(int threads, bool pinThreads)
+{
+    g_config.threads = threads;
+    g_config.pinThreads = pinThreads;
+}
+
+TaskScheduler::TaskScheduler(int threads, bool pinThreads)
+    : m_nextWorker(0)
+    , m_pending(0)
+    , m_stopping(false)
+    , m_stolen(0)
+{
+    for (int p = 0; p < PriorityCount; p++) {
+        m_queued[p] = 0;
+        m_completed[p] = 0;
+        m_canceled[p] = 0;
+        m_waitNs[p] = 0;
+        m_maxWaitNs[p] = 0;
+        m_runNs[p] = 0;
+    }
+    for (int i = 0; i < threads; i++) {
+        m_workers.push_back(std::make_unique<Worker>());
+    }
+    // Started only once every deque exists, workers steal from all of them
+    for (int i = 0; i < threads; i++) {
+        m_workers[i]->thread = std::thread([this, i, pinThreads]() { workerLoop(i, pinThreads); });
+    }
+}
+
+TaskScheduler::~TaskScheduler()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_sleepMutex);
+        m_stopping = true;
+    }
+    m_wake.notify_all();
+    for (auto &worker : m_workers) {
+        worker->thread.join();
+    }
+}
+
+void TaskScheduler::submit(Priority priority, std::function<void()> task, const CancelToken &token,
+                           TaskGroup *group)
+{
+    Task t{ std::move(task), token, group ? group->m_state : nullptr, priority, Clock::now() };
+    if (t.group) {
+        std::lock_guard<std::mutex> lock(t.group->mutex);
+        t.group->pending++;
+    }
+
+    const int target = t_scheduler == this ? t_workerIndex : int(m_nextWorker++ % m_workers.size());
+    {
+        std::lock_guard<std::mutex> lock(m_workers[target]->mutex);
+        m_workers[target]->queues[priority].push_back(std::move(t));
+    }
+    m_queued[priority]++;
+    {
+        std::lock_guard<std::mutex> lock(m_sleepMutex);
+        m_pending++;
+    }
+    m_wake.notify_one();
+}
+
+TaskScheduler::Counters TaskScheduler::counters() const
+{
+    Counters c;
+    c.threads = threadCount();
+    c.stolen = m_stolen.load();
+    for (int p = 0; p < PriorityCount; p++) {
+        c.queued[p] = std::max(0, m_queued[p].load());
+        c.completed[p] = m_completed[p].load();
+        c.canceled[p] = m_canceled[p].load();
+        c.meanWaitMs[p] = c.completed[p] ? m_waitNs[p].load() / 1e6 / c.completed[p] : 0;
+        c.maxWaitMs[p] = m_maxWaitNs[p].load() / 1e6;
+        c.meanRunMs[p] = c.completed[p] ? m_runNs[p].load() / 1e6 / c.completed[p] : 0;
+    }
+    return c;
+}
+
+void TaskScheduler::workerLoop(int index, bool pin)
+{
+    t_scheduler = this;
+    t_workerIndex = index;
+    if (pin) {
+        pinToCore(index);
+    }
+
+    for (;;) {
+        Task task;
+        if (takeTask(index, task)) {
+            runTask(task);
+            continue;
+        }
+        std::unique_lock<std::mutex> lock(m_sleepMutex);
+        m_wake.wait(lock, [this] { return m_stopping || m_pending.load() > 0; });
+        if (m_stopping) {
+            return;
+        }
+    }
+}
+
+bool TaskScheduler::takeTask(int self, Task &task)
+{
+    const int workers = int(m_workers.size());
+    for (int p = PriorityCount - 1; p >= 0; p--) {
+        if (m_queued[p].load(std::memory_order_relaxed) <= 0) {
+            continue;
+        }
+
+        bool found = false;
+        {
+            // Own newest first, its data is the most likely to still be in cache
+            Worker &own = *m_workers[self];
+            std::lock_guard<std::mutex> lock(own.mutex);
+            if (!own.queues[p].empty()) {
+                task = std::move(own.queues[p].back());
+                own.queues[p].pop_back();
+                found = true;
+            }
+        }
+        for (int i = 1; !found && i < workers; i++) {
+            // Then the oldest of someone else's
+            Worker &victim = *m_workers[(self + i) % workers];
+            std::lock_guard<std::mutex> lock(victim.mutex);
+            if (!victim.queues[p].empty()) {
+                task = std::move(victim.queues[p].front());
+                victim.queues[p].pop_front();
+                found = true;
+                m_stolen++;
+            }
+        }
+
+        if (found) {
+            m_queued[p]--;
+            m_pending--;
+            return true;
+        }
+    }
+    return false;
+}
+
+void TaskScheduler::runTask(Task &task)
+{
+    const int p = task.priority;
+    if (task.token.isCanceled()) {
+        m_canceled[p]++;
+    } else {
+        const auto started = Clock::now();
+        const qint64 waitNs = std::chrono::duration_cast<std::chrono::nanoseconds>(started - task.submitted).count();
+        task.run();
+        const qint64 runNs = std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - started).count();
+
+        m_waitNs[p] += waitNs;
+        m_runNs[p] += runNs;
+        qint64 maxWait = m_maxWaitNs[p].load();
+        while (waitNs > maxWait && !m_maxWaitNs[p].compare_exchange_weak(maxWait, waitNs)) {
+        }
+        m_completed[p]++;
+    }
+    // Released before the group is, whatever the task captured goes first
+    task.run = nullptr;
+
+    if (task.group) {
+        std::lock_guard<std::mutex> lock(task.group->mutex);
+        if (--task.group->pending == 0) {
+            task.group->done.notify_all();
+        }
+    }
+}
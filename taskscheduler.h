@@ -0,0 +1,131 @@
+#ifndef TASKSCHEDULER_H
+#define TASKSCHEDULER_H
+
+#include <QtGlobal>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// The one pool of worker threads all background work in the process runs on, so
+// subsystems never oversubscribe the machine by each starting their own.
+// Every worker has a deque per priority. It runs its own newest task first and steals
+// the oldest from the others once it runs dry; a higher priority task anywhere is
+// always taken before a lower one.
+//
+// Thread count defaults to QThread::idealThreadCount() with workers free to move
+// between cores. CENSORME_THREADS=<n> and CENSORME_PIN_THREADS=1 in the environment,
+// or configure() before first use, change that.
+class TaskScheduler
+{
+public:
+    // Higher runs first
+    enum Priority {
+        Export,
+        Prefetch,
+        Interactive,
+        PriorityCount
+    };
+
+    // Shared between whoever submits a task and the task. A task canceled before it
+    // starts is dropped; a running one polls isCanceled() or hands flag() to a kernel.
+    class CancelToken
+    {
+    public:
+        CancelToken() : m_flag(std::make_shared<std::atomic_bool>(false)) {}
+        void cancel() { m_flag->store(true); }
+        bool isCanceled() const { return m_flag->load(std::memory_order_relaxed); }
+        const std::atomic_bool *flag() const { return m_flag.get(); }
+
+    private:
+        std::shared_ptr<std::atomic_bool> m_flag;
+    };
+
+    // Tracks the tasks submitted with it, so their owner can wait for all of them
+    // before destroying whatever they post results back to
+    class TaskGroup
+    {
+    public:
+        TaskGroup() : m_state(std::make_shared<State>()) {}
+        ~TaskGroup() { wait(); }
+        void wait();
+
+    private:
+        friend class TaskScheduler;
+        struct State {
+            std::mutex mutex;
+            std::condition_variable done;
+            int pending = 0;
+        };
+        std::shared_ptr<State> m_state;
+    };
+
+    struct Counters {
+        int threads;
+        int queued[PriorityCount];       // Waiting to start right now
+        qint64 completed[PriorityCount];
+        qint64 canceled[PriorityCount];  // Dropped before they started
+        qint64 stolen;                   // Taken from another worker's deque
+        double meanWaitMs[PriorityCount]; // Submission to start
+        double maxWaitMs[PriorityCount];
+        double meanRunMs[PriorityCount];
+    };
+
+    static TaskScheduler &instance();
+    // Only has an effect before the first instance() call. threads <= 0 keeps the default.
+    static void configure(int threads, bool pinThreads);
+
+    ~TaskScheduler();
+
+    // Called from a worker, the task goes to that worker's own deque
+    void submit(Priority priority, std::function<void()> task, const CancelToken &token = CancelToken(),
+                TaskGroup *group = nullptr);
+
+    int threadCount() const { return int(m_workers.size()); }
+    Counters counters() const;
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    struct Task {
+        std::function<void()> run;
+        CancelToken token;
+        std::shared_ptr<TaskGroup::State> group;
+        int priority;
+        Clock::time_point submitted;
+    };
+    struct Worker {
+        std::mutex mutex;
+        std::deque<Task> queues[PriorityCount];
+        std::thread thread;
+    };
+
+    TaskScheduler(int threads, bool pinThreads);
+    void workerLoop(int index, bool pin);
+    bool takeTask(int self, Task &task);
+    void runTask(Task &task);
+
+private:
+    std::vector<std::unique_ptr<Worker>> m_workers;
+    std::atomic<unsigned> m_nextWorker;
+
+    std::mutex m_sleepMutex;
+    std::condition_variable m_wake;
+    std::atomic<int> m_pending; // Raised under m_sleepMutex, so a worker never sleeps past a submit
+    bool m_stopping;
+
+    std::atomic<int> m_queued[PriorityCount];
+    std::atomic<qint64> m_completed[PriorityCount];
+    std::atomic<qint64> m_canceled[PriorityCount];
+    std::atomic<qint64> m_waitNs[PriorityCount];
+    std::atomic<qint64> m_maxWaitNs[PriorityCount];
+    std::atomic<qint64> m_runNs[PriorityCount];
+    std::atomic<qint64> m_stolen;
+};
+
+#endif // TASKSCHEDULER_H
@@ -0,0 +1,312 @@
+#include "watchservice.h"
+#include "censorrender.h"
+#include "defs.h"
+#include <QDateTime>
+#include <QDebug>
+#include <QDir>
+#include <QFileInfo>
+#include <QSaveFile>
+#include <algorithm>
+
+namespace {
+
+// Saving a mask writes the PNG and then the JSON, renders wait for both
+constexpr int DebounceMs = 500;
+// Manifests are rewritten whole, so they are batched
+constexpr int ManifestSaveDelayMs = 2000;
+
+} // namespace
+
+WatchService::WatchService(const QString &root, const QString &outputDir, const QVector<ExportRendition> &renditions,
+                           int maxConcurrent, QObject *parent)
+    : QObject(parent)
+    , m_root(QDir::cleanPath(QDir(root).absolutePath()))
+    , m_outputDir(QDir::cleanPath(QDir(outputDir).absolutePath()))
+    , m_renditions(renditions)
+    , m_params(CensorRender::exportParameters(renditions))
+    , m_maxConcurrent(std::max(1, maxConcurrent))
+    , m_serial(0)
+{
+    m_debounceTimer.setSingleShot(true);
+    connect(&m_debounceTimer, &QTimer::timeout, this, &WatchService::promoteDue);
+    m_manifestTimer.setSingleShot(true);
+    m_manifestTimer.setInterval(ManifestSaveDelayMs);
+    connect(&m_manifestTimer, &QTimer::timeout, this, &WatchService::saveManifests);
+}
+
+WatchService::~WatchService()
+{
+    // Jobs post their results back to this object
+    m_cancel.cancel();
+    m_tasks.wait();
+    saveManifests();
+}
+
+bool WatchService::start()
+{
+    if (!QFileInfo(m_root).isDir()) {
+        return false;
+    }
+    m_clock.start();
+
+    connect(&m_watcher, &QFileSystemWatcher::directoryChanged, this, &WatchService::directoryChanged);
+    // Directory watches don't see files being rewritten in place, which is how the
+    // editor saves sidecars, so the sidecar JSONs are watched one by one
+    connect(&m_watcher, &QFileSystemWatcher::fileChanged, this, [this](const QString &path) {
+        QFileInfo sidecar(path);
+        if (sidecar.exists()) {
+            m_watcher.addPath(path); // Dropped when the file was replaced rather than rewritten
+        }
+        QDir imageDir(sidecar.absolutePath());
+        imageDir.cdUp();
+        touch(imageDir.absoluteFilePath(sidecar.completeBaseName()), SidecarChanged);
+    });
+
+    watchTree(m_root, InitialScan);
+    return true;
+}
+
+void WatchService::watchTree(const QString &dir, Priority priority)
+{
+    if (isExcluded(dir)) {
+        return;
+    }
+    m_watcher.addPath(dir);
+    watchSidecars(dir + QDir::separator() + CensorMeDataDir);
+    scanImages(dir, priority);
+
+    QDir d(dir);
+    for (const auto &name : d.entryList(QDir::Dirs | QDir::NoDotAndDotDot)) {
+        if (name != CensorMeDataDir) {
+            watchTree(d.absoluteFilePath(name), priority);
+        }
+    }
+}
+
+void WatchService::watchSidecars(const QString &dataDir)
+{
+    QDir d(dataDir);
+    if (!d.exists()) {
+        return;
+    }
+    QStringList paths = { d.absolutePath() };
+    for (const auto &name : d.entryList({ "*.json" }, QDir::Files)) {
+        paths << d.absoluteFilePath(name);
+    }
+    m_watcher.addPaths(paths); // Already watched ones are skipped
+}
+
+void WatchService::directoryChanged(const QString &dir)
+{
+    QFileInfo fi(dir);
+    if (!fi.isDir()) {
+        return; // Gone, the watcher has already dropped it
+    }
+
+    if (fi.fileName() == CensorMeDataDir) {
+        // Sidecars were added, removed or renamed
+        watchSidecars(dir);
+        scanImages(fi.absolutePath(), SidecarChanged);
+        return;
+    }
+
+    // New subfolders, including a CensorMeData that was just created
+    QDir d(dir);
+    const auto watched = m_watcher.directories();
+    for (const auto &name : d.entryList(QDir::Dirs | QDir::NoDotAndDotDot)) {
+        auto path = d.absoluteFilePath(name);
+        if (watched.contains(path)) continue;
+        if (name == CensorMeDataDir) {
+            watchSidecars(path);
+        } else {
+            watchTree(path, NewImage);
+        }
+    }
+    scanImages(dir, NewImage);
+}
+
+void WatchService::scanImages(const QString &dir, Priority priority)
+{
+    for (const auto &source : CensorRender::imageFiles(dir)) {
+        touch(source, priority);
+    }
+}
+
+void WatchService::touch(const QString &source, Priority priority)
+{
+    // Only stats, the fingerprint that decides whether to render reads file contents
+    auto current = stamp(source);
+    auto &known = m_stamps[source];
+    if (known == current) {
+        return;
+    }
+    known = current;
+    schedule(source, priority);
+}
+
+void WatchService::schedule(const QString &source, Priority priority)
+{
+    // Every further change pushes the render back, an image is rendered once it settled
+    auto &entry = m_debouncing[source];
+    entry.first = m_clock.elapsed() + DebounceMs;
+    entry.second = std::max(entry.second, int(priority));
+    if (!m_debounceTimer.isActive()) {
+        m_debounceTimer.start(DebounceMs);
+    }
+}
+
+void WatchService::promoteDue()
+{
+    const qint64 now = m_clock.elapsed();
+    qint64 nextDue = -1;
+    for (auto it = m_debouncing.begin(); it != m_debouncing.end();) {
+        if (it->first > now) {
+            nextDue = nextDue < 0 ? it->first : std::min(nextDue, it->first);
+            ++it;
+            continue;
+        }
+        const int priority = it->second;
+        if (m_queuedPriority.value(it.key(), -1) < priority) {
+            // A lower priority entry still in the queue goes stale
+            m_queuedPriority[it.key()] = priority;
+            m_queue.push({ priority, m_serial++, it.key() });
+        }
+        it = m_debouncing.erase(it);
+    }
+    if (nextDue >= 0) {
+        m_debounceTimer.start(int(nextDue - now));
+    }
+    dispatch();
+}
+
+void WatchService::dispatch()
+{
+    while (m_running.size() < m_maxConcurrent && !m_queue.empty()) {
+        const Job job = m_queue.top();
+        m_queue.pop();
+        if (m_queuedPriority.value(job.source, -1) != job.priority) {
+            continue;
+        }
+        m_queuedPriority.remove(job.source);
+
+        if (m_running.contains(job.source)) {
+            m_rerun.insert(job.source);
+            continue;
+        }
+        if (!QFileInfo::exists(job.source)) {
+            m_stamps.remove(job.source);
+            continue;
+        }
+
+        const auto outputDir = outputDirFor(job.source);
+        const auto fileName = QFileInfo(job.source).fileName();
+
+        m_running.insert(job.source);
+        const auto source = job.source;
+        const auto renditions = m_renditions;
+        const auto params = m_params;
+        // A snapshot, shared until finish() records into the original
+        const ExportManifest manifest = manifestFor(outputDir);
+        // Runs below whatever the editor is doing in the same process. The fingerprint
+        // reads the sidecar's contents, so it is taken here and not on the event loop.
+        TaskScheduler::instance().submit(TaskScheduler::Export, [this, source, outputDir, fileName, renditions, params, manifest]() {
+            QElapsedTimer timer;
+            timer.start();
+
+            const auto fingerprint = ExportManifest::fingerprint(source, CensorRender::sidecarBasePath(source), params);
+            bool upToDate = std::all_of(renditions.begin(), renditions.end(), [&](const ExportRendition &rendition) {
+                return manifest.isUpToDate(ExportRenditions::outputName(fileName, rendition), fingerprint);
+            });
+            if (upToDate) {
+                QMetaObject::invokeMethod(this, [=]() { finish(source, fingerprint, true, true, 0); }, Qt::QueuedConnection);
+                return;
+            }
+
+            QVector<QByteArray> encoded;
+            bool ok = CensorRender::renderFile(source, renditions, encoded);
+            for (int r = 0; ok && r < renditions.size(); r++) {
+                // Whoever reads the output tree never sees a half-written image
+                QSaveFile f(outputDir + QDir::separator() + ExportRenditions::outputName(fileName, renditions[r]));
+                ok = QDir().mkpath(QFileInfo(f.fileName()).absolutePath()) &&
+                     f.open(QFile::WriteOnly) &&
+                     f.write(encoded[r]) == encoded[r].size() &&
+                     f.commit();
+            }
+
+            const double seconds = timer.nsecsElapsed() / 1e9;
+            QMetaObject::invokeMethod(this, [=]() { finish(source, fingerprint, false, ok, seconds); }, Qt::QueuedConnection);
+        }, m_cancel, &m_tasks);
+    }
+}
+
+void WatchService::finish(const QString &source, const QString &fingerprint, bool upToDate, bool ok, double seconds)
+{
+    m_running.remove(source);
+
+    // Up to date means nothing was rendered, and there is nothing to record
+    if (ok && !upToDate) {
+        const auto fileName = QFileInfo(source).fileName();
+        auto &manifest = manifestFor(outputDirFor(source));
+        for (const auto &rendition : m_renditions) {
+            manifest.record(ExportRenditions::outputName(fileName, rendition), fingerprint);
+        }
+        if (!m_manifestTimer.isActive()) {
+            m_manifestTimer.start();
+        }
+        emit rendered(source, seconds);
+    } else if (!ok) {
+        emit failed(source);
+    }
+
+    if (m_rerun.remove(source)) {
+        schedule(source, SidecarChanged);
+    }
+    dispatch();
+}
+
+void WatchService::saveManifests()
+{
+    for (auto it = m_manifests.begin(); it != m_manifests.end(); ++it) {
+        if (!it.value().save()) {
+            qWarning() << "Cannot write export manifest in" << it.key();
+        }
+    }
+}
+
+bool WatchService::isExcluded(const QString &dir) const
+{
+    // Outputs inside the watched tree must not feed back into it
+    auto path = QDir::cleanPath(QDir(dir).absolutePath());
+    return path == m_outputDir || path.startsWith(m_outputDir + '/');
+}
+
+QString WatchService::outputDirFor(const QString &source) const
+{
+    auto relativeDir = QDir(m_root).relativeFilePath(QFileInfo(source).absolutePath());
+    return QDir::cleanPath(m_outputDir + '/' + relativeDir);
+}
+
+ExportManifest &WatchService::manifestFor(const QString &outputDir)
+{
+    auto it = m_manifests.find(outputDir);
+    if (it == m_manifests.end()) {
+        it = m_manifests.insert(outputDir, ExportManifest(outputDir));
+        it.value().load();
+    }
+    return it.value();
+}
+
+QString WatchService::stamp(const QString &source)
+{
+    QString result;
+    auto sidecar = CensorRender::sidecarBasePath(source);
+    for (const auto &path : { source, sidecar + ".png", sidecar + ".json" }) {
+        QFileInfo fi(path);
+        if (fi.exists()) {
+            result += QString("%1:%2;").arg(fi.size()).arg(fi.lastModified().toMSecsSinceEpoch());
+        } else {
+            result += "-;";
+        }
+    }
+    return result;
+}
@@ -0,0 +1,95 @@
+#ifndef WATCHSERVICE_H
+#define WATCHSERVICE_H
+
+#include "exportmanifest.h"
+#include "exportrenditions.h"
+#include "taskscheduler.h"
+#include <QElapsedTimer>
+#include <QFileSystemWatcher>
+#include <QHash>
+#include <QJsonObject>
+#include <QObject>
+#include <QSet>
+#include <QTimer>
+#include <queue>
+
+// Long-running worker that keeps an output tree in sync with a folder tree of images
+// and their CensorMeData sidecars. Changes are picked up through QFileSystemWatcher,
+// debounced per image, and rendered through a priority queue by at most
+// maxConcurrent threads. Outputs land in <output>/<relative dir>/, with the same
+// renditions and manifest a folder export writes, so unchanged images are never
+// rendered twice, not even across restarts.
+class WatchService : public QObject
+{
+    Q_OBJECT
+public:
+    WatchService(const QString &root, const QString &outputDir, const QVector<ExportRendition> &renditions,
+                 int maxConcurrent, QObject *parent = nullptr);
+    ~WatchService();
+
+    // Starts watching and queues everything whose outputs are missing or stale
+    bool start();
+
+signals:
+    void rendered(const QString &source, double seconds);
+    void failed(const QString &source);
+
+private:
+    // Higher runs first. Freshly saved masks are what someone is waiting on.
+    enum Priority {
+        InitialScan,
+        NewImage,
+        SidecarChanged,
+    };
+    struct Job {
+        int priority;
+        quint64 serial;
+        QString source;
+        // std::priority_queue pops the largest: highest priority, then oldest
+        bool operator<(const Job &other) const {
+            return priority != other.priority ? priority < other.priority : serial > other.serial;
+        }
+    };
+
+    void watchTree(const QString &dir, Priority priority);
+    void watchSidecars(const QString &dataDir);
+    void directoryChanged(const QString &dir);
+    void scanImages(const QString &dir, Priority priority);
+    void touch(const QString &source, Priority priority);
+    void schedule(const QString &source, Priority priority);
+    void promoteDue();
+    void dispatch();
+    // upToDate: the task found the outputs current and rendered nothing
+    void finish(const QString &source, const QString &fingerprint, bool upToDate, bool ok, double seconds);
+    void saveManifests();
+
+    bool isExcluded(const QString &dir) const;
+    QString outputDirFor(const QString &source) const;
+    ExportManifest &manifestFor(const QString &outputDir);
+    static QString stamp(const QString &source);
+
+private:
+    QString m_root;
+    QString m_outputDir;
+    QVector<ExportRendition> m_renditions;
+    QJsonObject m_params;
+
+    QFileSystemWatcher m_watcher;
+    int m_maxConcurrent;
+    TaskScheduler::TaskGroup m_tasks;
+    TaskScheduler::CancelToken m_cancel;
+    QTimer m_debounceTimer;
+    QTimer m_manifestTimer;
+    QElapsedTimer m_clock;
+
+    QHash<QString, QString> m_stamps; // Source -> sizes and mtimes of it and its sidecars when last seen
+    QHash<QString, QPair<qint64, int>> m_debouncing; // Source -> (due time, priority)
+    std::priority_queue<Job> m_queue;
+    QHash<QString, int> m_queuedPriority; // Entries in m_queue with another priority are stale
+    QSet<QString> m_running;
+    QSet<QString> m_rerun; // Changed again while rendering
+    QHash<QString, ExportManifest> m_manifests;
+    quint64 m_serial;
+};
+
+#endif // WATCHSERVICE_H